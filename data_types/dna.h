@@ -7,6 +7,8 @@
 #include "utils/fmgrprotos.h"
 #include "funcapi.h"
 #include "executor/spi.h"
+#include "port/pg_bswap.h"
+#include "port/simd.h"
 
 #include <math.h>
 #include <float.h>
@@ -16,68 +18,419 @@
 #define VALID_NUCLEOTIDES   4
 const char nucleotides[VALID_NUCLEOTIDES * 2 + 1] = {'A', 'C', 'G', 'T'};
 
+/*
+ * 2-bit nucleotide codes. The order matches the ASCII order of the bases, so
+ * comparing packed codes gives the same result as comparing the strings.
+ */
+#define NUCLEOTIDE_A        0
+#define NUCLEOTIDE_C        1
+#define NUCLEOTIDE_G        2
+#define NUCLEOTIDE_T        3
+
+/* Code + 1 for every valid (upper or lower case) base, 0 otherwise */
+static const uint8 nucleotide_codes[256] = {
+    ['A'] = NUCLEOTIDE_A + 1, ['C'] = NUCLEOTIDE_C + 1,
+    ['G'] = NUCLEOTIDE_G + 1, ['T'] = NUCLEOTIDE_T + 1,
+    ['a'] = NUCLEOTIDE_A + 1, ['c'] = NUCLEOTIDE_C + 1,
+    ['g'] = NUCLEOTIDE_G + 1, ['t'] = NUCLEOTIDE_T + 1,
+};
+#define NUCLEOTIDE_CODE(c)  ((int) nucleotide_codes[(uint8) (c)] - 1)
+
+/* Characters validated and packed at once by dna_pack_blocks */
+#define DNA_PACK_BLOCK      ((int) sizeof(Vector8))
+
 /******************************************************************************
  * TYPE STRUCT
  ******************************************************************************/
 
+/*
+ * A dna value stores its bases packed 2 bits per base, 4 bases per byte with
+ * the first base in the most significant bits. Bases that cannot be expressed
+ * in 2 bits are stored as runs in an exception list placed (int-aligned) after
+ * the packed bases; the packed bits under a run are zero. Runs are kept in
+ * order, and adjacent runs always hold different characters.
+ */
 typedef struct {
     int32 vl_len_;
-    int32 length;       
-    char sequence[FLEXIBLE_ARRAY_MEMBER];  
+    int32 length;       /* number of bases */
+    int32 nexceptions;  /* number of non-ACGT runs */
+    uint8 bases[FLEXIBLE_ARRAY_MEMBER];
 } dna;
 
+typedef struct {
+    int32 start;        /* position of the first base of the run */
+    int32 length;       /* number of bases in the run */
+    char  base;         /* character repeated over the run */
+} dna_exception;
+
+#define DNA_HDRSZ               offsetof(dna, bases)
+#define DNA_PACKED_SIZE(len)    (((len) + 3) >> 2)
+#define DNA_EXCEPTIONS(seq) \
+    ((dna_exception *) ((char *) (seq)->bases + INTALIGN(DNA_PACKED_SIZE((seq)->length))))
+#define DNA_BASE_AT(seq, i) \
+    (((seq)->bases[(i) >> 2] >> (6 - (((i) & 3) << 1))) & 3)
+
+/*
+ * Rolling iterator over the k-mers of a dna value. Every step shifts one base
+ * into a right-aligned 2-bit window, so the next k-mer is a shift and a mask;
+ * windows overlapping an exception run are skipped. In canonical mode the
+ * reverse complement of the window is rolled from the other end, and the
+ * smaller of the two is returned, so both strands give the same k-mers.
+ */
+typedef struct {
+    const dna *seq;
+    int k;
+    bool canonical;
+    int pos;            /* next base to shift into the window */
+    int valid;          /* bases shifted in since the last exception run */
+    int exc;            /* next exception run that can affect pos */
+    uint64 mask;        /* low 2k bits */
+    uint64 window;
+    uint64 rcwindow;    /* reverse complement of window */
+} dna_kmer_iter;
+
+/*
+ * Growable buffer packing a sequence that arrives in pieces (e.g. the lines
+ * of a FASTA record). IUPAC ambiguity codes other than A, C, G and T become
+ * exception runs, as in assemblies where N marks gaps.
+ */
+typedef struct {
+    uint8 *bases;
+    Size capacity;      /* allocated bytes of bases, kept zeroed past the end */
+    int64 length;
+    dna_exception *exceptions;
+    int nexceptions;
+    int maxexceptions;
+} dna_builder;
+
+/* Characters stored as exception runs by dna_builder */
+#define DNA_EXCEPTION_BASES     "NRYKMSWBDHVU"
+
+/* Complementary IUPAC code of every exception base; U pairs with A */
+static const char dna_complement_bases[256] = {
+    ['N'] = 'N', ['R'] = 'Y', ['Y'] = 'R', ['K'] = 'M', ['M'] = 'K', ['S'] = 'S',
+    ['W'] = 'W', ['B'] = 'V', ['V'] = 'B', ['D'] = 'H', ['H'] = 'D', ['U'] = 'A',
+};
+
 /******************************************************************************
  * AUXILIARY FUNCTIONS DECLARATION
  ******************************************************************************/
 
-static dna *dna_make(int length, const char *sequence);
-static bool is_valid_sequence(const char *sequence);
+static int dna_pack_blocks(uint8 *bases, const char *str, int len);
+static dna *dna_alloc(int length, int nexceptions);
 static dna *dna_parse(const char *str);
 static char *dna_to_string(const dna *seq);
-static char *to_uppercase(const char *data, int length);
+static dna *dna_reverse_complement_internal(const dna *seq);
+static void dna_kmer_iter_init(dna_kmer_iter *it, const dna *seq, int k, bool canonical);
+static bool dna_kmer_iter_next(dna_kmer_iter *it, uint64 *code, int *start);
+static void dna_builder_init(dna_builder *b);
+static void dna_builder_append(dna_builder *b, const char *str, int len, bool skip_blanks);
+static dna *dna_builder_finish(dna_builder *b);
 
 /******************************************************************************
  * AUXILIARY FUNCTIONS IMPLEMENTATION
  ******************************************************************************/
 
-static dna *dna_make(int length, const char *sequence) {
-    dna *result = (dna *) palloc(VARHDRSZ + sizeof(int32) + length + 1);
-    SET_VARSIZE(result, VARHDRSZ + sizeof(int32) + length + 1);
+/*
+ * Pack 8 valid bases into 2 bytes. Bits 1 and 2 of the ASCII code of A, C, G
+ * and T, in either case, give the 2-bit code as (c >> 1 ^ c >> 2) & 3; the
+ * codes of neighbouring bytes are then merged pairwise into nibbles and bytes.
+ */
+static inline void dna_pack8(uint8 *dst, const char *src) {
+    uint64 x;
+
+    memcpy(&x, src, sizeof(x));
+#ifdef WORDS_BIGENDIAN
+    x = pg_bswap64(x);
+#endif
+    x = ((x >> 1) ^ (x >> 2)) & UINT64CONST(0x0303030303030303);
+    x = ((x & UINT64CONST(0x00FF00FF00FF00FF)) << 2) | ((x >> 8) & UINT64CONST(0x00FF00FF00FF00FF));
+    x = ((x & UINT64CONST(0x0000FFFF0000FFFF)) << 4) | ((x >> 16) & UINT64CONST(0x0000FFFF0000FFFF));
+    dst[0] = (uint8) x;
+    dst[1] = (uint8) (x >> 32);
+}
+
+/* Whether the DNA_PACK_BLOCK characters at str are all A, C, G or T */
+static inline bool dna_block_is_acgt(const char *str) {
+#ifndef USE_NO_SIMD
+    Vector8 chunk;
+    Vector8 lower;
+    Vector8 valid;
+
+    vector8_load(&chunk, (const uint8 *) str);
+    lower = vector8_or(chunk, vector8_broadcast(0x20));
+    valid = vector8_or(vector8_or(vector8_eq(lower, vector8_broadcast('a')),
+                                  vector8_eq(lower, vector8_broadcast('c'))),
+                       vector8_or(vector8_eq(lower, vector8_broadcast('g')),
+                                  vector8_eq(lower, vector8_broadcast('t'))));
+    return !vector8_is_highbit_set(vector8_eq(valid, vector8_broadcast(0)));
+#else
+    for (int i = 0; i < DNA_PACK_BLOCK; i++) {
+        if (NUCLEOTIDE_CODE(str[i]) < 0)
+            return false;
+    }
+    return true;
+#endif
+}
+
+/*
+ * Validate, case-fold and pack the leading blocks of str made only of A, C, G
+ * and T into bases, starting at a byte boundary. Returns the number of
+ * characters packed, a multiple of DNA_PACK_BLOCK; the caller handles the
+ * rest, including errors, one character at a time.
+ */
+static int dna_pack_blocks(uint8 *bases, const char *str, int len) {
+    int i;
+
+    for (i = 0; i + DNA_PACK_BLOCK <= len && dna_block_is_acgt(str + i); i += DNA_PACK_BLOCK) {
+        for (int j = 0; j < DNA_PACK_BLOCK; j += 8)
+            dna_pack8(bases + ((i + j) >> 2), str + i + j);
+    }
+    return i;
+}
+
+static dna *dna_alloc(int length, int nexceptions) {
+    Size size = DNA_HDRSZ + INTALIGN(DNA_PACKED_SIZE(length)) +
+                nexceptions * sizeof(dna_exception);
+    dna *result = (dna *) palloc0(size);
+    SET_VARSIZE(result, size);
     result->length = length;
-    strcpy(result->sequence, sequence); 
-    result->sequence[length] = '\0';  
+    result->nexceptions = nexceptions;
     return result;
 }
 
-static bool is_valid_sequence(const char *sequence) {
-    for (int i = 0; sequence[i] != '\0'; i++) {
-        bool valid = false;
-        for (int j = 0; j < 4; j++) {
-            if (sequence[i] == nucleotides[j]) {
-                valid = true;
-                break;
+/*
+ * Validate, case-fold and pack the input in a single pass, so that the output
+ * of dna_to_string, exception runs included, reads back unchanged
+ */
+static dna *dna_parse(const char *str) {
+    dna_builder b;
+    dna *result;
+
+    dna_builder_init(&b);
+    dna_builder_append(&b, str, strlen(str), false);
+    result = dna_builder_finish(&b);
+    pfree(b.bases);
+    pfree(b.exceptions);
+    return result;
+}
+
+static char *dna_to_string(const dna *seq) {
+    char *result = palloc(seq->length + 1);
+    const dna_exception *exc = DNA_EXCEPTIONS(seq);
+
+    for (int i = 0; i < seq->length; i++)
+        result[i] = nucleotides[DNA_BASE_AT(seq, i)];
+    for (int e = 0; e < seq->nexceptions; e++)
+        memset(result + exc[e].start, exc[e].base, exc[e].length);
+    result[seq->length] = '\0';
+    return result;
+}
+
+/*
+ * Reverse a byte of 4 packed bases and complement them (A-T and C-G are the
+ * codes b and 3 - b, i.e. ~b on 2 bits)
+ */
+static inline uint8 dna_revcomp_byte(uint8 byte) {
+    uint8 x = ~byte;
+
+    x = ((x >> 2) & 0x33) | ((x & 0x33) << 2);
+    return (x >> 4) | (x << 4);
+}
+
+/*
+ * Reverse complement of a sequence. The packed bytes are reversed and
+ * complemented whole, then shifted to drop the padding that ends up in front;
+ * runs are mirrored with complementary codes and their bits cleared again.
+ */
+static dna *dna_reverse_complement_internal(const dna *seq) {
+    const dna_exception *exc = DNA_EXCEPTIONS(seq);
+    int nbytes = DNA_PACKED_SIZE(seq->length);
+    int shift = 2 * ((4 - (seq->length & 3)) & 3);
+    int nexceptions = 0;
+    dna *result;
+    dna_exception *rexc;
+
+    /* Runs of U become plain A bases */
+    for (int e = 0; e < seq->nexceptions; e++) {
+        if (exc[e].base != 'U')
+            nexceptions++;
+    }
+    result = dna_alloc(seq->length, nexceptions);
+
+    for (int i = 0; i < nbytes; i++) {
+        uint8 byte = dna_revcomp_byte(seq->bases[nbytes - 1 - i]) << shift;
+
+        if (shift > 0 && i + 1 < nbytes)
+            byte |= dna_revcomp_byte(seq->bases[nbytes - 2 - i]) >> (8 - shift);
+        result->bases[i] = byte;
+    }
+
+    rexc = DNA_EXCEPTIONS(result);
+    for (int e = seq->nexceptions - 1; e >= 0; e--) {
+        int start = seq->length - exc[e].start - exc[e].length;
+
+        for (int i = start; i < start + exc[e].length; i++)
+            result->bases[i >> 2] &= ~(3 << (6 - ((i & 3) << 1)));
+        if (exc[e].base != 'U') {
+            rexc->start = start;
+            rexc->length = exc[e].length;
+            rexc->base = dna_complement_bases[(uint8) exc[e].base];
+            rexc++;
+        }
+    }
+    return result;
+}
+
+static void dna_kmer_iter_init(dna_kmer_iter *it, const dna *seq, int k, bool canonical) {
+    it->seq = seq;
+    it->k = k;
+    it->canonical = canonical;
+    it->pos = 0;
+    it->valid = 0;
+    it->exc = 0;
+    it->mask = (k >= 32) ? ~UINT64CONST(0) : (UINT64CONST(1) << (2 * k)) - 1;
+    it->window = 0;
+    it->rcwindow = 0;
+}
+
+/*
+ * Advance to the next k-mer. Returns false when the sequence is exhausted,
+ * otherwise sets *code to the left-aligned k-mer code (the kmer layout) and
+ * *start to the position of its first base.
+ */
+static bool dna_kmer_iter_next(dna_kmer_iter *it, uint64 *code, int *start) {
+    const dna_exception *exc = DNA_EXCEPTIONS(it->seq);
+
+    while (it->pos < it->seq->length) {
+        int i = it->pos;
+
+        if (it->exc < it->seq->nexceptions) {
+            while (it->exc < it->seq->nexceptions &&
+                   exc[it->exc].start + exc[it->exc].length <= i)
+                it->exc++;
+            if (it->exc < it->seq->nexceptions && exc[it->exc].start <= i) {
+                /* Jump over the run and restart the window after it */
+                it->pos = exc[it->exc].start + exc[it->exc].length;
+                it->valid = 0;
+                continue;
             }
         }
-        if (!valid) {
-            return false;
+
+        it->window = ((it->window << 2) | DNA_BASE_AT(it->seq, i)) & it->mask;
+        if (it->canonical)
+            it->rcwindow = (it->rcwindow >> 2) |
+                           ((uint64) (3 - DNA_BASE_AT(it->seq, i)) << (2 * it->k - 2));
+        it->pos++;
+        if (++it->valid >= it->k) {
+            *code = (it->canonical ? Min(it->window, it->rcwindow) : it->window) << (64 - 2 * it->k);
+            *start = i - it->k + 1;
+            return true;
         }
     }
-    return true;
+    return false;
 }
 
-static dna *dna_parse(const char *str) {
-    int length = strlen(str);
-    char *upper_str = to_uppercase(str, length); 
-
-    if (!is_valid_sequence(upper_str)) {
-        ereport(ERROR, (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
-                        errmsg("Invalid character in DNA sequence")));
-    }       
-    return dna_make(length, upper_str);    
+static void dna_builder_init(dna_builder *b) {
+    b->capacity = 1024;
+    b->bases = (uint8 *) palloc0(b->capacity);
+    b->length = 0;
+    b->maxexceptions = 8;
+    b->exceptions = (dna_exception *) palloc(b->maxexceptions * sizeof(dna_exception));
+    b->nexceptions = 0;
 }
 
-static char *dna_to_string(const dna *seq) {
-    return psprintf("%s", seq->sequence);
+static void dna_builder_add_exception(dna_builder *b, char base) {
+    dna_exception *last;
+
+    if (b->nexceptions > 0) {
+        last = &b->exceptions[b->nexceptions - 1];
+        if (last->base == base && last->start + last->length == b->length) {
+            last->length++;
+            return;
+        }
+    }
+    if (b->nexceptions == b->maxexceptions) {
+        b->maxexceptions *= 2;
+        b->exceptions = (dna_exception *) repalloc_huge(b->exceptions,
+                            b->maxexceptions * sizeof(dna_exception));
+    }
+    last = &b->exceptions[b->nexceptions++];
+    last->start = b->length;
+    last->length = 1;
+    last->base = base;
+}
+
+/*
+ * Validate and pack len characters in a single pass; blanks (spaces, tabs and
+ * carriage returns) are skipped if skip_blanks and rejected otherwise.
+ * Runs of plain bases go through dna_pack_blocks whenever the sequence is at
+ * a byte boundary.
+ */
+static void dna_builder_append(dna_builder *b, const char *str, int len, bool skip_blanks) {
+    Size needed = DNA_PACKED_SIZE(b->length + len);
+
+    if (needed > b->capacity) {
+        Size newcapacity = b->capacity;
+
+        while (newcapacity < needed)
+            newcapacity *= 2;
+        b->bases = (uint8 *) repalloc_huge(b->bases, newcapacity);
+        memset(b->bases + b->capacity, 0, newcapacity - b->capacity);
+        b->capacity = newcapacity;
+    }
+
+    for (int i = 0; i < len; i++) {
+        int code;
+
+        if ((b->length & 3) == 0 && len - i >= DNA_PACK_BLOCK) {
+            int n = dna_pack_blocks(b->bases + (b->length >> 2), str + i, len - i);
+
+            b->length += n;
+            i += n;
+            if (i == len)
+                break;
+        }
+
+        code = NUCLEOTIDE_CODE(str[i]);
+        if (code >= 0) {
+            b->bases[b->length >> 2] |= code << (6 - ((b->length & 3) << 1));
+            b->length++;
+        } else if (skip_blanks && (str[i] == ' ' || str[i] == '\t' || str[i] == '\r')) {
+            continue;
+        } else {
+            char upper = str[i] & ~0x20;
+
+            if (upper == 0 || strchr(DNA_EXCEPTION_BASES, upper) == NULL)
+                ereport(ERROR, (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+                                errmsg("Invalid character in DNA sequence")));
+            dna_builder_add_exception(b, upper);
+            b->length++;
+        }
+    }
+}
+
+/*
+ * Return the sequence built so far and empty the builder for the next one
+ */
+static dna *dna_builder_finish(dna_builder *b) {
+    dna *result;
+
+    if (b->length > PG_INT32_MAX ||
+        DNA_HDRSZ + INTALIGN(DNA_PACKED_SIZE(b->length)) +
+        (Size) b->nexceptions * sizeof(dna_exception) > MaxAllocSize)
+        ereport(ERROR, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                        errmsg("DNA sequence of %lld bases is too long", (long long) b->length)));
+
+    result = dna_alloc((int) b->length, b->nexceptions);
+    memcpy(result->bases, b->bases, DNA_PACKED_SIZE(b->length));
+    if (b->nexceptions > 0)
+        memcpy(DNA_EXCEPTIONS(result), b->exceptions, b->nexceptions * sizeof(dna_exception));
+
+    memset(b->bases, 0, DNA_PACKED_SIZE(b->length));
+    b->length = 0;
+    b->nexceptions = 0;
+    return result;
 }
 
-#endif // DNA_H
\ No newline at end of file
+#endif // DNA_H
@@ -0,0 +1,141 @@
+#ifndef HLL_H
+#define HLL_H
+
+/******************************************************************************
+ * TYPE STRUCT
+ ******************************************************************************/
+
+/*
+ * HyperLogLog estimate of the number of distinct k-mers: the hash of every
+ * k-mer (kmer_code_hash) picks a register from its top precision bits and
+ * raises it to the rank of the first 1 bit among the others. Two hlls of the
+ * same k and precision merge by taking the largest of each register.
+ */
+typedef struct {
+    int32 vl_len_;      /* varlena header (do not touch directly!) */
+    int32 k;
+    int32 precision;    /* log2 of the number of registers */
+    uint8 registers[FLEXIBLE_ARRAY_MEMBER];
+} hll;
+
+#define HLL_MIN_PRECISION       4
+#define HLL_MAX_PRECISION       18
+#define HLL_DEFAULT_PRECISION   14      /* 16 KB, standard error 0.8% */
+#define HLL_NREGISTERS(p)       (1 << (p))
+#define HLL_SIZE(p)             (offsetof(hll, registers) + HLL_NREGISTERS(p))
+
+/******************************************************************************
+ * AUXILIARY FUNCTIONS DECLARATION
+ ******************************************************************************/
+
+static hll *hll_create(MemoryContext cxt, int k, int precision);
+static void hll_add(hll *h, uint64 hash);
+static void hll_add_dna(hll *h, const dna *seq);
+static void hll_merge(hll *dst, const hll *src);
+static double hll_estimate(const hll *h);
+static void *hll_read(StringInfo buf);
+static void hll_write(StringInfo buf, const void *value);
+
+/******************************************************************************
+ * AUXILIARY FUNCTIONS IMPLEMENTATION
+ ******************************************************************************/
+
+static hll *hll_create(MemoryContext cxt, int k, int precision) {
+    hll *h = (hll *) MemoryContextAllocZero(cxt, HLL_SIZE(precision));
+
+    SET_VARSIZE(h, HLL_SIZE(precision));
+    h->k = k;
+    h->precision = precision;
+    return h;
+}
+
+static inline void hll_add(hll *h, uint64 hash) {
+    int bits = 64 - h->precision;
+    uint64 rest = hash & ((UINT64CONST(1) << bits) - 1);
+    uint8 rank = rest == 0 ? bits + 1 : bits - pg_leftmost_one_pos64(rest);
+    uint8 *reg = &h->registers[hash >> bits];
+
+    if (rank > *reg)
+        *reg = rank;
+}
+
+static void hll_add_dna(hll *h, const dna *seq) {
+    dna_kmer_iter it;
+    uint64 code;
+    int start;
+
+    dna_kmer_iter_init(&it, seq, h->k, false);
+    while (dna_kmer_iter_next(&it, &code, &start))
+        hll_add(h, kmer_code_hash(code, h->k));
+}
+
+static void hll_merge(hll *dst, const hll *src) {
+    if (dst->k != src->k || dst->precision != src->precision)
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("Cannot merge hlls of different k or precision")));
+    for (int i = 0; i < HLL_NREGISTERS(dst->precision); i++)
+        dst->registers[i] = Max(dst->registers[i], src->registers[i]);
+}
+
+/*
+ * Raw HyperLogLog estimate, with linear counting over the empty registers
+ * while it is the more accurate of the two. With 64-bit hashes there are no
+ * collisions to correct for at the high end.
+ */
+static double hll_estimate(const hll *h) {
+    int m = HLL_NREGISTERS(h->precision);
+    double alpha;
+    double sum = 0;
+    int zeros = 0;
+    double estimate;
+
+    switch (m) {
+        case 16: alpha = 0.673; break;
+        case 32: alpha = 0.697; break;
+        case 64: alpha = 0.709; break;
+        default: alpha = 0.7213 / (1.0 + 1.079 / m); break;
+    }
+    for (int i = 0; i < m; i++) {
+        sum += ldexp(1.0, -h->registers[i]);
+        zeros += (h->registers[i] == 0);
+    }
+
+    estimate = alpha * m * m / sum;
+    if (estimate <= 2.5 * m && zeros > 0)
+        estimate = m * log((double) m / zeros);
+    return estimate;
+}
+
+/*
+ * Binary format of an hll: k and precision as int32, then the 2^precision
+ * registers as bytes
+ */
+static void *hll_read(StringInfo buf) {
+    int32 k = pq_getmsgint(buf, 4);
+    int32 precision = pq_getmsgint(buf, 4);
+    hll *result;
+
+    if (k <= 0 || k > MAX_KMER_LEN ||
+        precision < HLL_MIN_PRECISION || precision > HLL_MAX_PRECISION)
+        ereport(ERROR, (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+                        errmsg("invalid external hll value")));
+
+    result = hll_create(CurrentMemoryContext, k, precision);
+    pq_copymsgbytes(buf, (char *) result->registers, HLL_NREGISTERS(precision));
+    for (int i = 0; i < HLL_NREGISTERS(precision); i++) {
+        if (result->registers[i] > 64 - precision + 1)
+            ereport(ERROR, (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+                            errmsg("invalid external hll value")));
+    }
+    return result;
+}
+
+static void hll_write(StringInfo buf, const void *value) {
+    const hll *h = (const hll *) value;
+
+    pq_sendint32(buf, h->k);
+    pq_sendint32(buf, h->precision);
+    pq_sendbytes(buf, (const char *) h->registers, HLL_NREGISTERS(h->precision));
+}
+
+#endif // HLL_H
@@ -10,40 +10,70 @@
  * TYPE STRUCT
  ******************************************************************************/
 
+/*
+ * A kmer is a fixed-length value: the bases packed 2 bits each into a 64-bit
+ * code, first base in the most significant bits and unused low bits zero, plus
+ * the number of bases. Comparing codes as unsigned integers and then lengths
+ * orders kmers lexicographically, so a prefix and all its extensions form a
+ * contiguous range.
+ */
 typedef struct {
-    int32 vl_len_;
+    uint64 code;
     int32 k;
-    char data[33];
 } kmer;
 
+/* Mask covering the first k bases of a code */
+#define KMER_MASK(k) \
+    ((k) == 0 ? UINT64CONST(0) : ~UINT64CONST(0) << (64 - 2 * (k)))
+/* Mask covering the bases [from, to) of a code */
+#define KMER_RANGE_MASK(from, to)   (KMER_MASK(to) & ~KMER_MASK(from))
+#define KMER_BASE_AT(c, i)  (((c)->code >> (62 - 2 * (i))) & 3)
+
 /******************************************************************************
  * AUXILIARY FUNCTIONS DECLARATION
  ******************************************************************************/
 
 static kmer *kmer_make(int k, const char *data);
+static kmer *kmer_from_code(int k, uint64 code);
 static void p_whitespace(char **str);
 static void ensure_end_input(char **str, bool end);
-static bool is_valid_sequence(const char *sequence);
-static char *to_uppercase(const char *data, int length);
 static kmer *kmer_parse(const char *str);
 static char *kmer_to_str(const kmer *c);
-static bool starts_with(char *prefix, char *c);
-static int kmer_cmp_internal(kmer *a, kmer *b);
+static bool starts_with(const kmer *prefix, const kmer *c);
+static int kmer_cmp_internal(const kmer *a, const kmer *b);
+static uint64 kmer_hash_internal(const kmer *c, uint64 seed);
+static int kmer_mismatches(uint64 a, uint64 b, int len);
+static int kmer_hamming_internal(const kmer *a, const kmer *b);
+static uint64 kmer_revcomp_code(uint64 code, int k);
 
 /******************************************************************************
  * AUXILIARY FUNCTIONS IMPLEMENTATION
  ******************************************************************************/
 
 static kmer *kmer_make(int k, const char *data) {
-    kmer *c = (kmer *) palloc(VARHDRSZ + sizeof(int32) + k + 1);
-    SET_VARSIZE(c, VARHDRSZ + sizeof(int32) + k + 1);
+    uint8 packed[sizeof(uint64)] = {0};
+    int i = dna_pack_blocks(packed, data, k);
+    uint64 code;
+
+    memcpy(&code, packed, sizeof(code));
+    code = pg_ntoh64(code);
+    for (; i < k; i++) {
+        int base = NUCLEOTIDE_CODE(data[i]);
+        if (base < 0)
+            ereport(ERROR, (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION), errmsg("Invalid input syntax for type kmer")));
+        code |= (uint64) base << (62 - 2 * i);
+    }
+    return kmer_from_code(k, code);
+}
+
+static kmer *kmer_from_code(int k, uint64 code) {
+    kmer *c = (kmer *) palloc0(sizeof(kmer));
     c->k = k;
-    strncpy(c->data, data, k);
-    c->data[k] = '\0';
+    c->code = code & KMER_MASK(k);
     return c;
 }
 
-/* 
+/*
  * Remove leading whitespaces etc
  */
 static void p_whitespace(char **str) {
@@ -60,52 +90,96 @@ static void ensure_end_input(char **str, bool end) {
     }
 }
 
-static char *to_uppercase(const char *data, int length) {
-    char *upper_str = palloc(length + 1);
-    for (int i=0; i<length; i++) {
-        upper_str[i] = data[i];
-        if (data[i] >= 'a' && data[i] <= 'z') {
-            upper_str[i] &= ~0x20;
-        }
-    }
-    upper_str[length] = '\0';
-    return upper_str;
-}
-
 static kmer *kmer_parse(const char *str) {
     int k=strlen(str);
 
     if (k > MAX_KMER_LEN)
         ereport(ERROR, (errcode(ERRCODE_STRING_DATA_RIGHT_TRUNCATION), errmsg("Input exceeds maximum length allowed for type kmer (32)")));
-    
-    char *upper_str = to_uppercase(str, k);
-    if (!is_valid_sequence(upper_str))
-        ereport(ERROR, (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION), errmsg("Invalid input syntax for type kmer")));
 
-    return kmer_make(k, upper_str);
+    return kmer_make(k, str);
 }
 
 static char *kmer_to_str(const kmer *c) {
-    char *result = strdup(c->data);
+    char *result = palloc(c->k + 1);
+    for (int i = 0; i < c->k; i++)
+        result[i] = nucleotides[KMER_BASE_AT(c, i)];
+    result[c->k] = '\0';
     return result;
 }
 
-static bool starts_with(char *prefix, char *c) {
-    bool result;
-    result = strncmp(prefix, c, strlen(prefix)) == 0;
-    return result;
+static bool starts_with(const kmer *prefix, const kmer *c) {
+    return prefix->k <= c->k &&
+           ((prefix->code ^ c->code) & KMER_MASK(prefix->k)) == 0;
+}
+
+static int kmer_cmp_internal(const kmer *a, const kmer *b) {
+    // Codes are left-aligned, so a proper prefix compares equal and sorts first
+    if (a->code != b->code)
+        return a->code < b->code ? -1 : 1;
+    if (a->k != b->k)
+        return a->k < b->k ? -1 : 1;
+    return 0;
+}
+
+/*
+ * 64-bit finalizer (splitmix64) spreading every input bit over the output
+ */
+static inline uint64 kmer_mix64(uint64 x) {
+    x ^= x >> 30;
+    x *= UINT64CONST(0xbf58476d1ce4e5b9);
+    x ^= x >> 27;
+    x *= UINT64CONST(0x94d049bb133111eb);
+    x ^= x >> 31;
+    return x;
 }
 
-static int kmer_cmp_internal(kmer *a, kmer *b) {
-    int ret = strcmp(a->data, b->data);
-    // < 0: First non-matching character in a is lower (in ASCII) than that of b
-    if (ret < 0) {
-        return -1;
-    } else if (ret > 0) {
-        return 1;
-    } else {
+/*
+ * Hash of the k-mer with the given left-aligned code, the same as
+ * kmer_hash_internal with seed 0. Mixing in k keeps the all-A k-mer (code 0)
+ * from always hashing to 0.
+ */
+static inline uint64 kmer_code_hash(uint64 code, int k) {
+    return kmer_mix64(code ^ (uint64) k);
+}
+
+/*
+ * Seeded 64-bit hash of a kmer. The mixer maps 0 to 0, so with seed 0 the low
+ * 32 bits are the standard hash, as required of an extended hash function.
+ */
+static uint64 kmer_hash_internal(const kmer *c, uint64 seed) {
+    return kmer_mix64(c->code ^ (uint64) c->k ^ kmer_mix64(seed));
+}
+
+/*
+ * Number of differing bases among the first len bases of two codes: fold every
+ * differing 2-bit group onto its low bit and count the bits
+ */
+static int kmer_mismatches(uint64 a, uint64 b, int len) {
+    uint64 diff = (a ^ b) & KMER_MASK(len);
+    return pg_popcount64((diff | (diff >> 1)) & UINT64CONST(0x5555555555555555));
+}
+
+/*
+ * Hamming distance between two kmers. Kmers of different lengths are compared
+ * on their common length and every extra base counts as a mismatch.
+ */
+static int kmer_hamming_internal(const kmer *a, const kmer *b) {
+    return kmer_mismatches(a->code, b->code, Min(a->k, b->k)) + abs(a->k - b->k);
+}
+
+/*
+ * Reverse complement of the first k bases of a code: complement every base
+ * (~b on 2 bits), reverse the 2-bit groups of the word by swapping pairs,
+ * nibbles and bytes, and move the k bases back to the top
+ */
+static uint64 kmer_revcomp_code(uint64 code, int k) {
+    uint64 x = ~code;
+
+    if (k == 0)
         return 0;
-    }   
+    x = ((x >> 2) & UINT64CONST(0x3333333333333333)) | ((x & UINT64CONST(0x3333333333333333)) << 2);
+    x = ((x >> 4) & UINT64CONST(0x0F0F0F0F0F0F0F0F)) | ((x & UINT64CONST(0x0F0F0F0F0F0F0F0F)) << 4);
+    return pg_bswap64(x) << (64 - 2 * k);
 }
 
-#endif // KMER_H
\ No newline at end of file
+#endif // KMER_H
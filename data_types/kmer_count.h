@@ -0,0 +1,153 @@
+#ifndef KMER_COUNT_H
+#define KMER_COUNT_H
+
+#include "utils/memutils.h"
+
+/******************************************************************************
+ * TYPE STRUCT
+ ******************************************************************************/
+
+/*
+ * Open-addressing (linear probing) hash table counting the k-mers of a single
+ * length k, keyed on the packed code. A zero count marks an empty slot.
+ */
+typedef struct {
+    uint64 code;
+    int64 count;
+} kmer_count_entry;
+
+typedef struct {
+    int k;
+    uint64 size;                /* number of slots, a power of 2 */
+    uint64 used;                /* number of occupied slots */
+    kmer_count_entry *entries;
+    MemoryContext cxt;
+} kmer_count_table;
+
+#define KMER_COUNT_MIN_SIZE     1024
+#define KMER_COUNT_FILLFACTOR   0.75
+
+/* Last bin of kmer_spectrum, which also holds all higher counts */
+#define KMER_SPECTRUM_MAX_COUNT 10000
+
+/* Memory needed to count n distinct k-mers without growing the table */
+#define KMER_COUNT_BYTES(n) \
+    ((double) (n) / KMER_COUNT_FILLFACTOR * sizeof(kmer_count_entry))
+
+/******************************************************************************
+ * AUXILIARY FUNCTIONS DECLARATION
+ ******************************************************************************/
+
+static kmer_count_table *kmer_count_create(MemoryContext cxt, int k, uint64 nelements);
+static void kmer_count_add(kmer_count_table *table, uint64 code, int64 count);
+static bool kmer_count_add_bounded(kmer_count_table *table, uint64 code, int64 count, Size maxbytes);
+static void kmer_count_free(kmer_count_table *table);
+static void kmer_count_merge(kmer_count_table *dst, const kmer_count_table *src);
+
+/******************************************************************************
+ * AUXILIARY FUNCTIONS IMPLEMENTATION
+ ******************************************************************************/
+
+static kmer_count_entry *kmer_count_alloc_entries(MemoryContext cxt, uint64 size) {
+    return (kmer_count_entry *) MemoryContextAllocExtended(cxt,
+        size * sizeof(kmer_count_entry), MCXT_ALLOC_HUGE | MCXT_ALLOC_ZERO);
+}
+
+/*
+ * Create a table sized for nelements distinct k-mers
+ */
+static kmer_count_table *kmer_count_create(MemoryContext cxt, int k, uint64 nelements) {
+    kmer_count_table *table = MemoryContextAllocZero(cxt, sizeof(kmer_count_table));
+    uint64 size = KMER_COUNT_MIN_SIZE;
+
+    while (size * KMER_COUNT_FILLFACTOR < nelements)
+        size <<= 1;
+
+    table->k = k;
+    table->size = size;
+    table->cxt = cxt;
+    table->entries = kmer_count_alloc_entries(cxt, size);
+    return table;
+}
+
+static void kmer_count_grow(kmer_count_table *table) {
+    kmer_count_entry *old = table->entries;
+    uint64 oldsize = table->size;
+
+    table->size <<= 1;
+    table->entries = kmer_count_alloc_entries(table->cxt, table->size);
+    for (uint64 i = 0; i < oldsize; i++) {
+        if (old[i].count > 0) {
+            uint64 slot = kmer_mix64(old[i].code) & (table->size - 1);
+            while (table->entries[slot].count > 0)
+                slot = (slot + 1) & (table->size - 1);
+            table->entries[slot] = old[i];
+        }
+    }
+    pfree(old);
+}
+
+/* Slot holding code, or the empty slot where it belongs */
+static inline kmer_count_entry *kmer_count_slot(kmer_count_table *table, uint64 code) {
+    uint64 slot = kmer_mix64(code) & (table->size - 1);
+
+    while (table->entries[slot].count > 0 && table->entries[slot].code != code)
+        slot = (slot + 1) & (table->size - 1);
+    return &table->entries[slot];
+}
+
+static inline void kmer_count_insert(kmer_count_table *table, kmer_count_entry *entry,
+                                     uint64 code, int64 count) {
+    entry->code = code;
+    entry->count = count;
+    if (++table->used > table->size * KMER_COUNT_FILLFACTOR)
+        kmer_count_grow(table);
+}
+
+static void kmer_count_add(kmer_count_table *table, uint64 code, int64 count) {
+    kmer_count_entry *entry = kmer_count_slot(table, code);
+
+    if (entry->count > 0)
+        entry->count += count;
+    else
+        kmer_count_insert(table, entry, code, count);
+}
+
+/*
+ * Like kmer_count_add, but a new k-mer is refused (returning false) when the
+ * table would have to grow past maxbytes to take it. Counts of k-mers already
+ * in the table keep going up.
+ */
+static bool kmer_count_add_bounded(kmer_count_table *table, uint64 code, int64 count, Size maxbytes) {
+    kmer_count_entry *entry = kmer_count_slot(table, code);
+
+    if (entry->count > 0) {
+        entry->count += count;
+        return true;
+    }
+    if (table->used + 1 > table->size * KMER_COUNT_FILLFACTOR &&
+        (double) table->size * 2 * sizeof(kmer_count_entry) > maxbytes)
+        return false;
+    kmer_count_insert(table, entry, code, count);
+    return true;
+}
+
+static void kmer_count_free(kmer_count_table *table) {
+    pfree(table->entries);
+    pfree(table);
+}
+
+/*
+ * Add all counts of src into dst
+ */
+static void kmer_count_merge(kmer_count_table *dst, const kmer_count_table *src) {
+    if (dst->k != src->k)
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("Cannot merge counts of %d-mers and %d-mers", dst->k, src->k)));
+    for (uint64 i = 0; i < src->size; i++) {
+        if (src->entries[i].count > 0)
+            kmer_count_add(dst, src->entries[i].code, src->entries[i].count);
+    }
+}
+
+#endif // KMER_COUNT_H
@@ -0,0 +1,182 @@
+#ifndef KMER_SAMPLE_H
+#define KMER_SAMPLE_H
+
+/******************************************************************************
+ * TYPE STRUCT
+ ******************************************************************************/
+
+/*
+ * Sliding-window minimum over the hashes of consecutive k-mers, kept as a
+ * monotone deque in a ring buffer: hashes increase from front to back, so the
+ * front is the minimum of the window, and every k-mer is pushed and popped at
+ * most once. Ties keep the leftmost k-mer.
+ */
+typedef struct {
+    uint64 hash;
+    uint64 code;
+    int start;
+} kmer_sample_entry;
+
+typedef struct {
+    kmer_sample_entry *entries;
+    int capacity;       /* ring buffer size, at least the window length */
+    int w;              /* window length in k-mers */
+    int head;           /* index of the front */
+    int count;          /* number of entries */
+} kmer_min_deque;
+
+#define KMER_DEQUE_AT(d, i)     (&(d)->entries[((d)->head + (i)) % (d)->capacity])
+#define KMER_DEQUE_FRONT(d)     KMER_DEQUE_AT(d, 0)
+
+/*
+ * Minimizers: the k-mer of smallest hash in every window of w consecutive
+ * k-mers, each reported once. Windows do not span exception runs.
+ */
+typedef struct {
+    dna_kmer_iter kmers;
+    kmer_min_deque deque;
+    int run;            /* consecutive k-mers up to the last one */
+    int prev;           /* start of the last k-mer */
+    int last;           /* start of the last reported minimizer */
+} kmer_minimizer_iter;
+
+/*
+ * Closed syncmers: the k-mers whose smallest s-mer (by hash) is their first or
+ * their last one. The s-mers are rolled once and the window minimum of the
+ * k - s + 1 s-mers of every k-mer is kept in a deque; a second iterator in
+ * lockstep provides the code of the selected k-mers.
+ */
+typedef struct {
+    dna_kmer_iter smers;
+    dna_kmer_iter kmers;
+    kmer_min_deque deque;
+    int k;
+    int run;            /* consecutive s-mers up to the last one */
+    int prev;           /* start of the last s-mer */
+} kmer_syncmer_iter;
+
+/******************************************************************************
+ * AUXILIARY FUNCTIONS DECLARATION
+ ******************************************************************************/
+
+static void kmer_min_deque_init(kmer_min_deque *d, int w, int capacity);
+static void kmer_min_deque_push(kmer_min_deque *d, uint64 hash, uint64 code, int start);
+static void kmer_minimizer_iter_init(kmer_minimizer_iter *it, const dna *seq, int k, int w, bool canonical);
+static bool kmer_minimizer_iter_next(kmer_minimizer_iter *it, uint64 *code, int *start);
+static void kmer_syncmer_iter_init(kmer_syncmer_iter *it, const dna *seq, int k, int s, bool canonical);
+static bool kmer_syncmer_iter_next(kmer_syncmer_iter *it, uint64 *code, int *start);
+
+/******************************************************************************
+ * AUXILIARY FUNCTIONS IMPLEMENTATION
+ ******************************************************************************/
+
+/*
+ * The deque never holds more entries than the window length or the number of
+ * k-mers pushed, so capacity can be the smaller of the two
+ */
+static void kmer_min_deque_init(kmer_min_deque *d, int w, int capacity) {
+    d->w = w;
+    d->capacity = Max(Min(w, capacity), 1);
+    d->entries = (kmer_sample_entry *) palloc(d->capacity * sizeof(kmer_sample_entry));
+    d->head = 0;
+    d->count = 0;
+}
+
+/*
+ * Add the k-mer following the last one pushed: drop the front when it leaves
+ * the window and every entry at the back with a larger hash
+ */
+static void kmer_min_deque_push(kmer_min_deque *d, uint64 hash, uint64 code, int start) {
+    kmer_sample_entry *e;
+
+    if (d->count > 0 && KMER_DEQUE_FRONT(d)->start <= start - d->w) {
+        d->head = (d->head + 1) % d->capacity;
+        d->count--;
+    }
+    while (d->count > 0 && KMER_DEQUE_AT(d, d->count - 1)->hash > hash)
+        d->count--;
+
+    e = KMER_DEQUE_AT(d, d->count);
+    e->hash = hash;
+    e->code = code;
+    e->start = start;
+    d->count++;
+}
+
+static void kmer_minimizer_iter_init(kmer_minimizer_iter *it, const dna *seq, int k, int w, bool canonical) {
+    dna_kmer_iter_init(&it->kmers, seq, k, canonical);
+    kmer_min_deque_init(&it->deque, w, seq->length - k + 1);
+    it->run = 0;
+    it->prev = -1;
+    it->last = -1;
+}
+
+static bool kmer_minimizer_iter_next(kmer_minimizer_iter *it, uint64 *code, int *start) {
+    uint64 c;
+    int s;
+
+    while (dna_kmer_iter_next(&it->kmers, &c, &s)) {
+        kmer_sample_entry *min;
+
+        if (s != it->prev + 1) {
+            /* An exception run broke the sequence: restart the windows */
+            it->deque.count = 0;
+            it->run = 0;
+        }
+        it->prev = s;
+        it->run++;
+        kmer_min_deque_push(&it->deque, kmer_code_hash(c, it->kmers.k), c, s);
+
+        min = KMER_DEQUE_FRONT(&it->deque);
+        if (it->run >= it->deque.w && min->start != it->last) {
+            it->last = min->start;
+            *code = min->code;
+            *start = min->start;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void kmer_syncmer_iter_init(kmer_syncmer_iter *it, const dna *seq, int k, int s, bool canonical) {
+    dna_kmer_iter_init(&it->smers, seq, s, canonical);
+    dna_kmer_iter_init(&it->kmers, seq, k, canonical);
+    kmer_min_deque_init(&it->deque, k - s + 1, seq->length - s + 1);
+    it->k = k;
+    it->run = 0;
+    it->prev = -1;
+}
+
+static bool kmer_syncmer_iter_next(kmer_syncmer_iter *it, uint64 *code, int *start) {
+    uint64 c;
+    int s;
+
+    while (dna_kmer_iter_next(&it->smers, &c, &s)) {
+        int kstart;
+        int min;
+
+        if (s != it->prev + 1) {
+            it->deque.count = 0;
+            it->run = 0;
+        }
+        it->prev = s;
+        it->run++;
+        kmer_min_deque_push(&it->deque, kmer_code_hash(c, it->smers.k), c, s);
+        if (it->run < it->deque.w)
+            continue;
+
+        kstart = s - it->deque.w + 1;
+        min = KMER_DEQUE_FRONT(&it->deque)->start;
+        if (min == kstart || min == s) {
+            /* The k-mer iterator skips the same runs, so it reaches kstart */
+            do {
+                if (!dna_kmer_iter_next(&it->kmers, code, start))
+                    return false;
+            } while (*start < kstart);
+            return true;
+        }
+    }
+    return false;
+}
+
+#endif // KMER_SAMPLE_H
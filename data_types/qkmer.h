@@ -2,86 +2,89 @@
 #define QKMER_H
 
 #define VALID_IUPAC_NUCLEOTIDES  16
-const char iupac_nucleotides[VALID_IUPAC_NUCLEOTIDES * 2 + 1] = {'A', 'C', 'G', 'T', 'U', 'W', 'S', 'M', 'K', 'R', 'Y', 'B', 'D', 'H', 'V', 'N'};
 /******************************************************************************
  * TYPE STRUCT
  ******************************************************************************/
 
+/*
+ * A qkmer stores for every position the set of bases it matches as a 4-bit
+ * mask (bit b for base code b, so an IUPAC code is the union of its bases),
+ * 2 positions per byte with the first in the high half. Unused halves are
+ * zero, so equal patterns have equal bytes.
+ */
 typedef struct
 {
     int32 k;
-    char  data[MAX_KMER_LEN + 1];
+    uint8 masks[MAX_KMER_LEN / 2];
 } qkmer;
 
+#define QKMER_SET_AT(q, i) \
+    (((q)->masks[(i) >> 1] >> (((i) & 1) ? 0 : 4)) & 0xF)
+
+/*
+ * Compiled form of a qkmer used for matching. allow[b] has the low bit of the
+ * 2-bit group of every position set when base code b matches the pattern
+ * there, so a packed kmer code is tested against all positions at once.
+ */
+typedef struct
+{
+    int32  k;
+    uint64 allow[VALID_NUCLEOTIDES];
+} qkmer_pattern;
+
+/* Low bit of every 2-bit group of a code */
+#define QKMER_LANES     UINT64CONST(0x5555555555555555)
+
+/* Set of matching bases (bit b for base code b) of every IUPAC code */
+static const uint8 iupac_masks[256] = {
+    ['A'] = 0x1, ['C'] = 0x2, ['G'] = 0x4, ['T'] = 0x8,
+    ['W'] = 0x9, ['S'] = 0x6, ['M'] = 0x3, ['K'] = 0xC,
+    ['R'] = 0x5, ['Y'] = 0xA, ['B'] = 0xE, ['D'] = 0xD,
+    ['H'] = 0xB, ['V'] = 0x7, ['N'] = 0xF,
+    ['a'] = 0x1, ['c'] = 0x2, ['g'] = 0x4, ['t'] = 0x8,
+    ['w'] = 0x9, ['s'] = 0x6, ['m'] = 0x3, ['k'] = 0xC,
+    ['r'] = 0x5, ['y'] = 0xA, ['b'] = 0xE, ['d'] = 0xD,
+    ['h'] = 0xB, ['v'] = 0x7, ['n'] = 0xF,
+};
+
+/* IUPAC code of every set of matching bases, the inverse of iupac_masks */
+static const char iupac_codes[VALID_IUPAC_NUCLEOTIDES + 1] = "UACMGRSVTWYHKDBN";
+
 /******************************************************************************
  * AUXILIARY FUNCTIONS DECLARATION
  ******************************************************************************/
 
-static qkmer *qkmer_make(int k, char *data);
-static bool is_valid_qkmer(const char *str);
-static bool nucleotide_matches(char iupac_code, char nucleotide);
+static qkmer *qkmer_make(int k, const char *data);
 static qkmer *qkmer_parse(const char *str);
 static char *qkmer_to_str(const qkmer *c);
-static bool contains(char *pattern, char *c);
-static char *to_uppercase(const char *data, int length);
+static void qkmer_compile(const qkmer *q, qkmer_pattern *pattern);
+static bool qkmer_pattern_matches(const qkmer_pattern *pattern, uint64 code, uint64 mask);
+static const qkmer_pattern *qkmer_cached_pattern(FmgrInfo *flinfo, const qkmer *q);
 
 /******************************************************************************
  * AUXILIARY FUNCTIONS IMPLEMENTATION
  ******************************************************************************/
 
+/*
+ * Validate the first k characters of data and store their base sets in a
+ * single pass over the iupac_masks table. U is the only code with an empty
+ * set.
+ */
 static qkmer *
-qkmer_make(int k, char *data)
+qkmer_make(int k, const char *data)
 {
     qkmer *c = palloc0(sizeof(qkmer));
-    c->k = k;
-    strcpy(c->data, data);
-    c->data[k] = '\0';
-    return c;
-}
 
-static bool 
-is_valid_qkmer(const char *str)
-{
-    for (int i = 0; str[i] != '\0'; i++) {
-        bool valid = false;
-        for (int j = 0; j < 16; j++) {
-            if (str[i] == iupac_nucleotides[j]) {
-                valid = true;
-                break;
-            }
-        }
-        if (!valid) {
-            return false;
-        }
-    }
-    return true;
-}
+    for (int i = 0; i < k; i++) {
+        uint8 ch = (uint8) data[i];
+        uint8 set = iupac_masks[ch];
 
-/* Check if character matches any IUPAC nucleotide code */
-static bool
-nucleotide_matches(char iupac_code, char nucleotide)
-{
-    iupac_code &= ~0x20;
-    switch(iupac_code) // compares iupac code against cases below
-    {
-        case 'A': return nucleotide == 'A';
-        case 'C': return nucleotide == 'C';
-        case 'G': return nucleotide == 'G';
-        case 'T': return nucleotide == 'T';
-        case 'U': return nucleotide == 'U';
-        case 'W': return nucleotide == 'A' || nucleotide == 'T';
-        case 'S': return nucleotide == 'C' || nucleotide == 'G';
-        case 'M': return nucleotide == 'A' || nucleotide == 'C';
-        case 'K': return nucleotide == 'G' || nucleotide == 'T';
-        case 'R': return nucleotide == 'A' || nucleotide == 'G';
-        case 'Y': return nucleotide == 'C' || nucleotide == 'T';
-        case 'B': return nucleotide == 'C' || nucleotide == 'G' || nucleotide == 'T';
-        case 'D': return nucleotide == 'A' || nucleotide == 'G' || nucleotide == 'T';
-        case 'H': return nucleotide == 'A' || nucleotide == 'C' || nucleotide == 'T';
-        case 'V': return nucleotide == 'A' || nucleotide == 'C' || nucleotide == 'G';
-        case 'N': return true;
-        default: return false;
+        if (set == 0 && (ch & ~0x20) != 'U')
+            ereport(ERROR, (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION), errmsg("Invalid input syntax for type qkmer")));
+        c->masks[i >> 1] |= (i & 1) ? set : set << 4;
     }
+    c->k = k;
+    return c;
 }
 
 static qkmer *
@@ -90,29 +93,72 @@ qkmer_parse(const char *str)
     int k = strlen(str);
     if (k > MAX_KMER_LEN)
         ereport(ERROR, (errcode(ERRCODE_STRING_DATA_RIGHT_TRUNCATION), errmsg("Input exceeds maximum length allowed for type qkmer (32)")));
-    char *upper_str = to_uppercase(str,k);
-    if (!is_valid_qkmer(upper_str))
-        ereport(ERROR, (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION), errmsg("Invalid input syntax for type qkmer")));
-    
-    return qkmer_make(k, upper_str);
+    return qkmer_make(k, str);
 }
 
 static char *
 qkmer_to_str(const qkmer *c) 
 {
-    char *result = strdup(c->data);
+    char *result = palloc(c->k + 1);
+    for (int i = 0; i < c->k; i++)
+        result[i] = iupac_codes[QKMER_SET_AT(c, i)];
+    result[c->k] = '\0';
     return result;
 }
 
-static bool contains(char *pattern, char *c) {
-
-    int len = strlen(pattern);
-    for (int i = 0; i < len; i++) {
-        if (!nucleotide_matches(pattern[i], c[i])) {
-            return false;
+/*
+ * Spread the bases of every position allowing base code b over allow[b]. U has
+ * an empty set and matches nothing.
+ */
+static void qkmer_compile(const qkmer *q, qkmer_pattern *pattern) {
+    memset(pattern, 0, sizeof(qkmer_pattern));
+    pattern->k = q->k;
+    for (int i = 0; i < q->k; i++) {
+        uint8 set = QKMER_SET_AT(q, i);
+        for (int b = 0; b < VALID_NUCLEOTIDES; b++) {
+            if (set & (1 << b))
+                pattern->allow[b] |= UINT64CONST(1) << (62 - 2 * i);
         }
     }
-    return true;
+}
+
+/*
+ * Check the positions of code selected by mask (whole 2-bit groups) against
+ * the pattern with a few word operations
+ */
+static bool qkmer_pattern_matches(const qkmer_pattern *pattern, uint64 code, uint64 mask) {
+    uint64 lo = code & QKMER_LANES;
+    uint64 hi = (code >> 1) & QKMER_LANES;
+    uint64 match = (pattern->allow[NUCLEOTIDE_A] & ~hi & ~lo) |
+                   (pattern->allow[NUCLEOTIDE_C] & ~hi & lo) |
+                   (pattern->allow[NUCLEOTIDE_G] & hi & ~lo) |
+                   (pattern->allow[NUCLEOTIDE_T] & hi & lo);
+    return ((match ^ QKMER_LANES) & mask & QKMER_LANES) == 0;
+}
+
+/*
+ * Compiled pattern of q, kept in fn_extra so that a query compares every row
+ * against the same pattern without compiling it again
+ */
+typedef struct
+{
+    qkmer         query;
+    qkmer_pattern pattern;
+} qkmer_pattern_cache;
+
+static const qkmer_pattern *qkmer_cached_pattern(FmgrInfo *flinfo, const qkmer *q) {
+    qkmer_pattern_cache *cache = (qkmer_pattern_cache *) flinfo->fn_extra;
+
+    if (cache == NULL) {
+        cache = MemoryContextAllocZero(flinfo->fn_mcxt, sizeof(qkmer_pattern_cache));
+        cache->query.k = -1;
+        flinfo->fn_extra = cache;
+    }
+    if (memcmp(&cache->query, q, sizeof(qkmer)) != 0) {
+        cache->query = *q;
+        qkmer_compile(q, &cache->pattern);
+    }
+    return &cache->pattern;
 }
 
 #endif // QKMER_H
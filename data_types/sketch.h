@@ -0,0 +1,238 @@
+#ifndef SKETCH_H
+#define SKETCH_H
+
+/******************************************************************************
+ * TYPE STRUCT
+ ******************************************************************************/
+
+/*
+ * A dna_sketch is a MinHash sketch of the canonical k-mers of one or more
+ * sequences: the sorted distinct k-mer hashes (kmer_code_hash) that are at
+ * most max_hash, keeping only the smallest size of them when size > 0.
+ * With scaled = 1 and a size this is a bottom-s (Mash) sketch; with size 0
+ * and max_hash = 2^64 / scaled it is a FracMinHash sketch, which keeps a fixed
+ * fraction of the k-mers and so supports containment of sets of any size.
+ */
+typedef struct {
+    int32 vl_len_;      /* varlena header (do not touch directly!) */
+    int32 k;
+    int32 size;         /* largest number of hashes kept, 0 for no limit */
+    int32 n;            /* number of hashes */
+    uint64 max_hash;    /* largest hash kept */
+    uint64 hashes[FLEXIBLE_ARRAY_MEMBER];   /* strictly increasing */
+} dna_sketch;
+
+#define DNA_SKETCH_HDRSZ        offsetof(dna_sketch, hashes)
+#define DNA_SKETCH_SIZE(n)      (DNA_SKETCH_HDRSZ + (Size) (n) * sizeof(uint64))
+#define DNA_SKETCH_MAX_HASH(scaled) \
+    ((scaled) <= 1 ? PG_UINT64_MAX : PG_UINT64_MAX / (uint64) (scaled))
+
+/*
+ * Sketch under construction. Hashes passing the current threshold are
+ * appended unsorted; when the buffer fills up, it is sorted, deduplicated and
+ * cut down to size, and a full sketch lowers the threshold to its largest
+ * hash, so most k-mers of a long sequence are rejected by one comparison.
+ */
+typedef struct {
+    int k;
+    int size;
+    uint64 max_hash;
+    uint64 threshold;   /* hashes above it cannot enter the sketch */
+    uint64 *hashes;
+    int n;
+    int nsorted;        /* length of the sorted, distinct prefix */
+    int capacity;
+} dna_sketch_builder;
+
+#define DNA_SKETCH_MIN_CAPACITY 1024
+/* Largest size of a bottom-s sketch, keeping the builder buffer allocatable */
+#define DNA_SKETCH_MAX_SIZE     (MaxAllocSize / (2 * sizeof(uint64)))
+
+/******************************************************************************
+ * AUXILIARY FUNCTIONS DECLARATION
+ ******************************************************************************/
+
+static dna_sketch_builder *dna_sketch_builder_create(MemoryContext cxt, int k, int size, uint64 max_hash);
+static void dna_sketch_builder_add(dna_sketch_builder *b, uint64 hash);
+static void dna_sketch_builder_add_dna(dna_sketch_builder *b, const dna *seq);
+static dna_sketch *dna_sketch_builder_finish(dna_sketch_builder *b);
+static void dna_sketch_compare(const dna_sketch *a, const dna_sketch *b,
+                               int64 *common, int64 *na, int64 *nb);
+static void *dna_sketch_read(StringInfo buf);
+static void dna_sketch_write(StringInfo buf, const void *value);
+
+/******************************************************************************
+ * AUXILIARY FUNCTIONS IMPLEMENTATION
+ ******************************************************************************/
+
+static dna_sketch_builder *dna_sketch_builder_create(MemoryContext cxt, int k, int size, uint64 max_hash) {
+    dna_sketch_builder *b = MemoryContextAllocZero(cxt, sizeof(dna_sketch_builder));
+
+    b->k = k;
+    b->size = size;
+    b->max_hash = max_hash;
+    b->threshold = max_hash;
+    b->capacity = Max(2 * size, DNA_SKETCH_MIN_CAPACITY);
+    b->hashes = MemoryContextAllocHuge(cxt, b->capacity * sizeof(uint64));
+    return b;
+}
+
+static int dna_sketch_hash_cmp(const void *a, const void *b) {
+    uint64 x = *(const uint64 *) a;
+    uint64 y = *(const uint64 *) b;
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Sort and deduplicate the buffer, keep its smallest size hashes, and grow it
+ * when the kept hashes would leave less than half of it free
+ */
+static void dna_sketch_builder_compact(dna_sketch_builder *b) {
+    int n = 0;
+
+    if (b->nsorted == b->n)
+        return;
+    qsort(b->hashes, b->n, sizeof(uint64), dna_sketch_hash_cmp);
+    for (int i = 0; i < b->n; i++) {
+        if (n == 0 || b->hashes[i] != b->hashes[n - 1])
+            b->hashes[n++] = b->hashes[i];
+    }
+    if (b->size > 0 && n >= b->size) {
+        n = b->size;
+        b->threshold = b->hashes[n - 1];
+    }
+    b->n = b->nsorted = n;
+
+    if (n > b->capacity / 2) {
+        b->capacity *= 2;
+        b->hashes = repalloc_huge(b->hashes, b->capacity * sizeof(uint64));
+    }
+}
+
+static void dna_sketch_builder_add(dna_sketch_builder *b, uint64 hash) {
+    if (hash > b->threshold)
+        return;
+    if (b->n == b->capacity)
+        dna_sketch_builder_compact(b);
+    b->hashes[b->n++] = hash;
+}
+
+static void dna_sketch_builder_add_dna(dna_sketch_builder *b, const dna *seq) {
+    dna_kmer_iter it;
+    uint64 code;
+    int start;
+
+    dna_kmer_iter_init(&it, seq, b->k, true);
+    while (dna_kmer_iter_next(&it, &code, &start))
+        dna_sketch_builder_add(b, kmer_code_hash(code, b->k));
+}
+
+static dna_sketch *dna_sketch_builder_finish(dna_sketch_builder *b) {
+    dna_sketch *result;
+
+    dna_sketch_builder_compact(b);
+    result = (dna_sketch *) palloc(DNA_SKETCH_SIZE(b->n));
+    SET_VARSIZE(result, DNA_SKETCH_SIZE(b->n));
+    result->k = b->k;
+    result->size = b->size;
+    result->n = b->n;
+    result->max_hash = b->max_hash;
+    memcpy(result->hashes, b->hashes, b->n * sizeof(uint64));
+    return result;
+}
+
+/* Number of hashes of a sketch that are at most limit */
+static int64 dna_sketch_count_upto(const dna_sketch *s, uint64 limit) {
+    int64 lo = 0;
+    int64 hi = s->n;
+
+    while (lo < hi) {
+        int64 mid = (lo + hi) / 2;
+        if (s->hashes[mid] <= limit)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/*
+ * Compare two sketches of the same k on the hash range both cover completely:
+ * up to the smaller max_hash, and up to the largest hash of a sketch that hit
+ * its size limit. Sets the hashes of each sketch in that range and the number
+ * they share. The merge is branch-free: comparisons of random hashes would
+ * mispredict half of the time.
+ */
+static void dna_sketch_compare(const dna_sketch *a, const dna_sketch *b,
+                               int64 *common, int64 *na, int64 *nb) {
+    uint64 limit = Min(a->max_hash, b->max_hash);
+    int64 i = 0;
+    int64 j = 0;
+    int64 shared = 0;
+
+    if (a->k != b->k)
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("Cannot compare sketches of %d-mers and %d-mers", a->k, b->k)));
+
+    if (a->size > 0 && a->n == a->size)
+        limit = Min(limit, a->hashes[a->n - 1]);
+    if (b->size > 0 && b->n == b->size)
+        limit = Min(limit, b->hashes[b->n - 1]);
+    *na = dna_sketch_count_upto(a, limit);
+    *nb = dna_sketch_count_upto(b, limit);
+
+    while (i < *na && j < *nb) {
+        uint64 x = a->hashes[i];
+        uint64 y = b->hashes[j];
+
+        shared += (x == y);
+        i += (x <= y);
+        j += (y <= x);
+    }
+    *common = shared;
+}
+
+/*
+ * Binary format of a dna_sketch: k, size and n as int32, then max_hash and
+ * the n hashes as int64
+ */
+static void *dna_sketch_read(StringInfo buf) {
+    int32 k = pq_getmsgint(buf, 4);
+    int32 size = pq_getmsgint(buf, 4);
+    int32 n = pq_getmsgint(buf, 4);
+    uint64 max_hash = (uint64) pq_getmsgint64(buf);
+    dna_sketch *result;
+
+    if (k <= 0 || k > MAX_KMER_LEN || size < 0 || size > DNA_SKETCH_MAX_SIZE ||
+        n < 0 || (size > 0 && n > size) ||
+        (int64) n * sizeof(uint64) > buf->len - buf->cursor)
+        ereport(ERROR, (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+                        errmsg("invalid external dna_sketch value")));
+
+    result = (dna_sketch *) palloc(DNA_SKETCH_SIZE(n));
+    SET_VARSIZE(result, DNA_SKETCH_SIZE(n));
+    result->k = k;
+    result->size = size;
+    result->n = n;
+    result->max_hash = max_hash;
+    for (int i = 0; i < n; i++) {
+        result->hashes[i] = (uint64) pq_getmsgint64(buf);
+        if (result->hashes[i] > max_hash || (i > 0 && result->hashes[i] <= result->hashes[i - 1]))
+            ereport(ERROR, (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+                            errmsg("invalid external dna_sketch value")));
+    }
+    return result;
+}
+
+static void dna_sketch_write(StringInfo buf, const void *value) {
+    const dna_sketch *sketch = (const dna_sketch *) value;
+
+    pq_sendint32(buf, sketch->k);
+    pq_sendint32(buf, sketch->size);
+    pq_sendint32(buf, sketch->n);
+    pq_sendint64(buf, sketch->max_hash);
+    for (int i = 0; i < sketch->n; i++)
+        pq_sendint64(buf, sketch->hashes[i]);
+}
+
+#endif // SKETCH_H
@@ -9,34 +9,116 @@
 CREATE OR REPLACE FUNCTION dna_in(cstring) 
     RETURNS dna 
     AS 'MODULE_PATHNAME', 'dna_in' 
-    LANGUAGE C IMMUTABLE;
+    LANGUAGE C IMMUTABLE COST 1000;
 
 CREATE OR REPLACE FUNCTION dna_out(dna) 
     RETURNS cstring 
     AS 'MODULE_PATHNAME', 'dna_out'
-    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 1000;
+
+CREATE OR REPLACE FUNCTION dna_recv(internal)
+    RETURNS dna
+    AS 'MODULE_PATHNAME', 'dna_recv'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 100;
+
+CREATE OR REPLACE FUNCTION dna_send(dna)
+    RETURNS bytea
+    AS 'MODULE_PATHNAME', 'dna_send'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 100;
+
+CREATE OR REPLACE FUNCTION dna_typanalyze(internal)
+    RETURNS boolean
+    AS 'MODULE_PATHNAME', 'dna_typanalyze'
+    LANGUAGE C STRICT PARALLEL SAFE COST 1;
 
 -- ********** kmer **********
 CREATE OR REPLACE FUNCTION kmer_in(cstring)
     RETURNS kmer
     AS 'MODULE_PATHNAME', 'kmer_in'
-    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 5;
 
 CREATE OR REPLACE FUNCTION kmer_out(kmer)
     RETURNS cstring
     AS 'MODULE_PATHNAME', 'kmer_out'
-    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 5;
+
+CREATE OR REPLACE FUNCTION kmer_recv(internal)
+    RETURNS kmer
+    AS 'MODULE_PATHNAME', 'kmer_recv'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 5;
+
+CREATE OR REPLACE FUNCTION kmer_send(kmer)
+    RETURNS bytea
+    AS 'MODULE_PATHNAME', 'kmer_send'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 5;
+
+CREATE OR REPLACE FUNCTION kmer_typanalyze(internal)
+    RETURNS boolean
+    AS 'MODULE_PATHNAME', 'kmer_typanalyze'
+    LANGUAGE C STRICT PARALLEL SAFE COST 1;
 
 -- ********** qkmer **********
 CREATE OR REPLACE FUNCTION qkmer_in(cstring)
     RETURNS qkmer
     AS 'MODULE_PATHNAME', 'qkmer_in'
-    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 10;
 
 CREATE OR REPLACE FUNCTION qkmer_out(qkmer)
     RETURNS cstring
     AS 'MODULE_PATHNAME', 'qkmer_out'
-    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 5;
+
+CREATE OR REPLACE FUNCTION qkmer_recv(internal)
+    RETURNS qkmer
+    AS 'MODULE_PATHNAME', 'qkmer_recv'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 5;
+
+CREATE OR REPLACE FUNCTION qkmer_send(qkmer)
+    RETURNS bytea
+    AS 'MODULE_PATHNAME', 'qkmer_send'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 5;
+
+-- ********** dna_sketch **********
+CREATE OR REPLACE FUNCTION dna_sketch_in(cstring)
+    RETURNS dna_sketch
+    AS 'MODULE_PATHNAME', 'dna_sketch_in'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 100;
+
+CREATE OR REPLACE FUNCTION dna_sketch_out(dna_sketch)
+    RETURNS cstring
+    AS 'MODULE_PATHNAME', 'dna_sketch_out'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 100;
+
+CREATE OR REPLACE FUNCTION dna_sketch_recv(internal)
+    RETURNS dna_sketch
+    AS 'MODULE_PATHNAME', 'dna_sketch_recv'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 100;
+
+CREATE OR REPLACE FUNCTION dna_sketch_send(dna_sketch)
+    RETURNS bytea
+    AS 'MODULE_PATHNAME', 'dna_sketch_send'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 100;
+
+-- ********** hll **********
+CREATE OR REPLACE FUNCTION hll_in(cstring)
+    RETURNS hll
+    AS 'MODULE_PATHNAME', 'hll_in'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 100;
+
+CREATE OR REPLACE FUNCTION hll_out(hll)
+    RETURNS cstring
+    AS 'MODULE_PATHNAME', 'hll_out'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 100;
+
+CREATE OR REPLACE FUNCTION hll_recv(internal)
+    RETURNS hll
+    AS 'MODULE_PATHNAME', 'hll_recv'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 100;
+
+CREATE OR REPLACE FUNCTION hll_send(hll)
+    RETURNS bytea
+    AS 'MODULE_PATHNAME', 'hll_send'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 100;
 
 /******************************************************************************
  * TYPE DEFINITIONS
@@ -45,19 +127,55 @@ CREATE OR REPLACE FUNCTION qkmer_out(qkmer)
 CREATE TYPE dna (  
     internallength = variable,
     input          = dna_in,
-    output         = dna_out  
+    output         = dna_out,
+    receive        = dna_recv,
+    send           = dna_send,
+    analyze        = dna_typanalyze,
+    -- Packed bases barely compress; storing them uncompressed lets length()
+    -- and substring() fetch only the chunks they need
+    storage        = external
 );
 
 CREATE TYPE kmer (
-    internallength = variable,
+    internallength = 16,
     input          = kmer_in,
-    output         = kmer_out
+    output         = kmer_out,
+    receive        = kmer_recv,
+    send           = kmer_send,
+    analyze        = kmer_typanalyze,
+    alignment      = double
 );
 
 CREATE TYPE qkmer (
-    internallength = 33,
+    internallength = 20,
     input = qkmer_in,
-    output = qkmer_out
+    output = qkmer_out,
+    receive = qkmer_recv,
+    send = qkmer_send,
+    alignment = int4
+);
+
+-- MinHash sketch of the k-mers of sequences; the hashes are random, so
+-- compressing them is wasted effort
+CREATE TYPE dna_sketch (
+    internallength = variable,
+    input          = dna_sketch_in,
+    output         = dna_sketch_out,
+    receive        = dna_sketch_recv,
+    send           = dna_sketch_send,
+    alignment      = double,
+    storage        = external
+);
+
+-- HyperLogLog registers of a set of k-mers; sparse ones compress well
+CREATE TYPE hll (
+    internallength = variable,
+    input          = hll_in,
+    output         = hll_out,
+    receive        = hll_recv,
+    send           = hll_send,
+    alignment      = int4,
+    storage        = extended
 );
 
 /******************************************************************************
@@ -68,18 +186,94 @@ CREATE TYPE qkmer (
 CREATE FUNCTION length(dna)
     RETURNS int4
     AS 'MODULE_PATHNAME', 'dna_length'
-    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 10;
+
+CREATE FUNCTION substring(dna, integer, integer)
+    RETURNS dna
+    AS 'MODULE_PATHNAME', 'dna_substring'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 10;
+
+CREATE FUNCTION reverse_complement(dna)
+    RETURNS dna
+    AS 'MODULE_PATHNAME', 'dna_reverse_complement'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 100;
+
+CREATE FUNCTION contains(dna, kmer)
+    RETURNS boolean
+    AS 'MODULE_PATHNAME', 'dna_contains_kmer'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 1000;
+
+CREATE FUNCTION contains(dna, qkmer)
+    RETURNS boolean
+    AS 'MODULE_PATHNAME', 'dna_contains_qkmer'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 1000;
+
+/* Server-side loaders; paths are relative to the data directory */
+CREATE FUNCTION read_fasta(path text)
+    RETURNS TABLE(id text, description text, sequence dna)
+    AS 'MODULE_PATHNAME', 'read_fasta'
+    LANGUAGE C VOLATILE STRICT PARALLEL SAFE COST 100000 ROWS 100;
+
+CREATE FUNCTION read_fastq(path text)
+    RETURNS TABLE(id text, description text, sequence dna, quality text)
+    AS 'MODULE_PATHNAME', 'read_fastq'
+    LANGUAGE C VOLATILE STRICT PARALLEL SAFE COST 100000 ROWS 100000;
+
+-- Reading server files is reserved to superusers unless granted, as for pg_read_file
+REVOKE EXECUTE ON FUNCTION read_fasta(text) FROM PUBLIC;
+REVOKE EXECUTE ON FUNCTION read_fastq(text) FROM PUBLIC;
+
+/* Foreign data wrapper exposing FASTA/FASTQ files as tables */
+CREATE FUNCTION dnasequence_fdw_handler()
+    RETURNS fdw_handler
+    AS 'MODULE_PATHNAME', 'dnasequence_fdw_handler'
+    LANGUAGE C STRICT;
+
+CREATE FUNCTION dnasequence_fdw_validator(text[], oid)
+    RETURNS void
+    AS 'MODULE_PATHNAME', 'dnasequence_fdw_validator'
+    LANGUAGE C STRICT;
+
+CREATE FOREIGN DATA WRAPPER dnasequence_fdw
+    HANDLER dnasequence_fdw_handler
+    VALIDATOR dnasequence_fdw_validator;
+
+/* Additional functions for the GIN operator class */
+CREATE FUNCTION dna_gin_options(internal)
+    RETURNS void
+    AS 'MODULE_PATHNAME', 'dna_gin_options'
+    LANGUAGE C IMMUTABLE PARALLEL SAFE COST 1;
+
+CREATE FUNCTION dna_gin_extract_value(dna, internal)
+    RETURNS internal
+    AS 'MODULE_PATHNAME', 'dna_gin_extract_value'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 1000;
+
+CREATE FUNCTION dna_gin_extract_query(dna, internal, int2, internal, internal, internal, internal)
+    RETURNS internal
+    AS 'MODULE_PATHNAME', 'dna_gin_extract_query'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 1;
+
+CREATE FUNCTION dna_gin_consistent(internal, int2, dna, int4, internal, internal, internal, internal)
+    RETURNS boolean
+    AS 'MODULE_PATHNAME', 'dna_gin_consistent'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 1;
+
+CREATE FUNCTION dna_gin_triconsistent(internal, int2, dna, int4, internal, internal, internal)
+    RETURNS "char"
+    AS 'MODULE_PATHNAME', 'dna_gin_triconsistent'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 1;
 
 -- ********** kmer **********
 CREATE OR REPLACE FUNCTION kmer(text)
     RETURNS kmer
     AS 'MODULE_PATHNAME', 'kmer_cast_from_text'
-    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 5;
 
 CREATE OR REPLACE FUNCTION text(kmer)
     RETURNS text
     AS 'MODULE_PATHNAME', 'kmer_cast_to_text'
-    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 5;
 
 CREATE CAST (text as kmer) WITH FUNCTION kmer(text) AS IMPLICIT;
 CREATE CAST (kmer as text) WITH FUNCTION text(kmer);
@@ -87,22 +281,44 @@ CREATE CAST (kmer as text) WITH FUNCTION text(kmer);
 CREATE FUNCTION kmer(int, text)
     RETURNS kmer
     AS 'MODULE_PATHNAME', 'kmer_constructor'
-    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 5;
 
 CREATE FUNCTION length(kmer)
     RETURNS int
     AS 'MODULE_PATHNAME', 'kmer_length'
-    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 1;
+
+CREATE FUNCTION reverse_complement(kmer)
+    RETURNS kmer
+    AS 'MODULE_PATHNAME', 'kmer_reverse_complement'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 1;
+
+CREATE FUNCTION canonical(kmer)
+    RETURNS kmer
+    AS 'MODULE_PATHNAME', 'kmer_canonical'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 1;
 
 CREATE FUNCTION equals(kmer, kmer)
     RETURNS boolean
     AS 'MODULE_PATHNAME', 'kmer_equals'
-    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 1;
+
+/* Planner support: prefix tests as btree ranges or SP-GiST prefix scans */
+CREATE FUNCTION kmer_starts_with_support(internal)
+    RETURNS internal
+    AS 'MODULE_PATHNAME', 'kmer_starts_with_support'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 1;
+
+CREATE FUNCTION kmer_starts_with_swapped_support(internal)
+    RETURNS internal
+    AS 'MODULE_PATHNAME', 'kmer_starts_with_swapped_support'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 1;
 
 CREATE FUNCTION starts_with(kmer, kmer)
     RETURNS boolean
     AS 'MODULE_PATHNAME', 'kmer_starts_with'
-    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 1
+    SUPPORT kmer_starts_with_support;
 
 -- CREATE FUNCTION kmer_starts_with_swapped(kmer, kmer)
 --     RETURNS boolean
@@ -112,70 +328,197 @@ CREATE FUNCTION starts_with(kmer, kmer)
 CREATE FUNCTION kmer_starts_with_swapped(kmer, kmer)
     RETURNS boolean
     AS 'MODULE_PATHNAME', 'kmer_starts_with_swapped'
-    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 1
+    SUPPORT kmer_starts_with_swapped_support;
 
-CREATE FUNCTION generate_kmers(dna, integer)
+CREATE FUNCTION hamming_distance(kmer, kmer)
+    RETURNS float8
+    AS 'MODULE_PATHNAME', 'kmer_distance'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 1;
+
+-- Depends on the dnasequence.hamming_threshold setting, hence STABLE
+CREATE FUNCTION hamming_similar(kmer, kmer)
+    RETURNS boolean
+    AS 'MODULE_PATHNAME', 'kmer_similar'
+    LANGUAGE C STABLE STRICT PARALLEL SAFE COST 1;
+
+/* Planner support: row estimates from the sequence length */
+CREATE FUNCTION generate_kmers_support(internal)
+    RETURNS internal
+    AS 'MODULE_PATHNAME', 'generate_kmers_support'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 1;
+
+CREATE FUNCTION kmer_count_support(internal)
+    RETURNS internal
+    AS 'MODULE_PATHNAME', 'kmer_count_support'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 1;
+
+-- With canonical, every k-mer is replaced by the smaller of it and its reverse complement
+CREATE FUNCTION generate_kmers(dna, integer, canonical boolean DEFAULT false)
     RETURNS SETOF kmer
     AS 'MODULE_PATHNAME', 'generate_kmers'
-    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 1000
+    SUPPORT generate_kmers_support;
+
+CREATE FUNCTION kmer_count(dna, integer, canonical boolean DEFAULT false)
+    RETURNS TABLE(kmer kmer, count bigint)
+    AS 'MODULE_PATHNAME', 'kmer_count'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 5000
+    SUPPORT kmer_count_support;
+
+-- Sampled k-mers with their 1-based position: one minimizer per window of w
+-- k-mers, or the closed syncmers for s-mers of length s
+CREATE FUNCTION generate_minimizers(dna, integer, w integer, canonical boolean DEFAULT false)
+    RETURNS TABLE("position" integer, kmer kmer)
+    AS 'MODULE_PATHNAME', 'generate_minimizers'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 1000;
+
+CREATE FUNCTION generate_syncmers(dna, integer, s integer, canonical boolean DEFAULT false)
+    RETURNS TABLE("position" integer, kmer kmer)
+    AS 'MODULE_PATHNAME', 'generate_syncmers'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 1000;
+
+/* Selectivity estimators */
+CREATE FUNCTION kmer_starts_with_sel(internal, oid, internal, integer)
+    RETURNS float8
+    AS 'MODULE_PATHNAME', 'kmer_starts_with_sel'
+    LANGUAGE C STABLE STRICT PARALLEL SAFE COST 1;
+
+CREATE FUNCTION kmer_contains_sel(internal, oid, internal, integer)
+    RETURNS float8
+    AS 'MODULE_PATHNAME', 'kmer_contains_sel'
+    LANGUAGE C STABLE STRICT PARALLEL SAFE COST 1;
+
+CREATE FUNCTION kmer_contained_sel(internal, oid, internal, integer)
+    RETURNS float8
+    AS 'MODULE_PATHNAME', 'kmer_contained_sel'
+    LANGUAGE C STABLE STRICT PARALLEL SAFE COST 1;
+
+/* Functions for the kmer_spectrum aggregate */
+CREATE FUNCTION kmer_spectrum_transfn(internal, dna, integer)
+    RETURNS internal
+    AS 'MODULE_PATHNAME', 'kmer_spectrum_transfn'
+    LANGUAGE C IMMUTABLE PARALLEL SAFE COST 1000;
+
+CREATE FUNCTION kmer_spectrum_transfn(internal, dna, integer, boolean)
+    RETURNS internal
+    AS 'MODULE_PATHNAME', 'kmer_spectrum_transfn'
+    LANGUAGE C IMMUTABLE PARALLEL SAFE COST 1000;
+
+CREATE FUNCTION kmer_spectrum_combinefn(internal, internal)
+    RETURNS internal
+    AS 'MODULE_PATHNAME', 'kmer_spectrum_combinefn'
+    LANGUAGE C IMMUTABLE PARALLEL SAFE COST 1000;
+
+CREATE FUNCTION kmer_spectrum_serialfn(internal)
+    RETURNS bytea
+    AS 'MODULE_PATHNAME', 'kmer_spectrum_serialfn'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 500;
+
+CREATE FUNCTION kmer_spectrum_deserialfn(bytea, internal)
+    RETURNS internal
+    AS 'MODULE_PATHNAME', 'kmer_spectrum_deserialfn'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 500;
+
+CREATE FUNCTION kmer_spectrum_finalfn(internal)
+    RETURNS bigint[]
+    AS 'MODULE_PATHNAME', 'kmer_spectrum_finalfn'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 100;
+
+CREATE AGGREGATE kmer_spectrum(dna, integer) (
+    SFUNC        = kmer_spectrum_transfn,
+    STYPE        = internal,
+    FINALFUNC    = kmer_spectrum_finalfn,
+    COMBINEFUNC  = kmer_spectrum_combinefn,
+    SERIALFUNC   = kmer_spectrum_serialfn,
+    DESERIALFUNC = kmer_spectrum_deserialfn,
+    PARALLEL     = SAFE
+);
+
+-- Spectrum of canonical k-mers when the last argument is true
+CREATE AGGREGATE kmer_spectrum(dna, integer, boolean) (
+    SFUNC        = kmer_spectrum_transfn,
+    STYPE        = internal,
+    FINALFUNC    = kmer_spectrum_finalfn,
+    COMBINEFUNC  = kmer_spectrum_combinefn,
+    SERIALFUNC   = kmer_spectrum_serialfn,
+    DESERIALFUNC = kmer_spectrum_deserialfn,
+    PARALLEL     = SAFE
+);
 
 /* Additional functions for the BTree operator class */
 CREATE FUNCTION kmer_lt(kmer, kmer)
     RETURNS boolean
     AS 'MODULE_PATHNAME', 'kmer_lt'
-    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 1;
 
 CREATE FUNCTION kmer_le(kmer, kmer)
     RETURNS boolean
     AS 'MODULE_PATHNAME', 'kmer_le'
-    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 1;
 
 CREATE FUNCTION kmer_gt(kmer, kmer)
     RETURNS boolean
     AS 'MODULE_PATHNAME', 'kmer_gt'
-    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 1;
 
 CREATE FUNCTION kmer_ge(kmer, kmer)
     RETURNS boolean
     AS 'MODULE_PATHNAME', 'kmer_ge'
-    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 1;
 
 CREATE FUNCTION kmer_cmp(kmer, kmer)
     RETURNS integer
     AS 'MODULE_PATHNAME', 'kmer_cmp'
-    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 1;
+
+CREATE FUNCTION kmer_sortsupport(internal)
+    RETURNS void
+    AS 'MODULE_PATHNAME', 'kmer_sortsupport'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 1;
 
 /* Additional functions for the hash operator class */
 CREATE FUNCTION kmer_hash(kmer)
     RETURNS integer
     AS 'MODULE_PATHNAME', 'kmer_hash'
-    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 1;
+
+CREATE FUNCTION kmer_hash_extended(kmer, bigint)
+    RETURNS bigint
+    AS 'MODULE_PATHNAME', 'kmer_hash_extended'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 1;
 
 /* Additional functions for the SP-GiST operator class */
 CREATE FUNCTION spgist_kmer_config(internal, internal)
     RETURNS void
     AS 'MODULE_PATHNAME', 'spgist_kmer_config'
-    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 1;
 
 CREATE FUNCTION spgist_kmer_choose(internal, internal)
     RETURNS void
     AS 'MODULE_PATHNAME', 'spgist_kmer_choose'
-    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 1;
 
 CREATE FUNCTION spgist_kmer_picksplit(internal, internal)
     RETURNS void
     AS 'MODULE_PATHNAME', 'spgist_kmer_picksplit'
-    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 1;
 
 CREATE FUNCTION spgist_kmer_inner_consistent(internal, internal)
     RETURNS void
     AS 'MODULE_PATHNAME', 'spgist_kmer_inner_consistent'
-    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 1;
 
 CREATE FUNCTION spgist_kmer_leaf_consistent(internal, internal)
     RETURNS bool
     AS 'MODULE_PATHNAME', 'spgist_kmer_leaf_consistent'
-    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 1;
+
+/* Additional functions for the BRIN operator classes */
+CREATE FUNCTION kmer_brin_minmax_consistent(internal, internal, internal)
+    RETURNS boolean
+    AS 'MODULE_PATHNAME', 'kmer_brin_minmax_consistent'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 1;
 
 -- CREATE FUNCTION spgist_kmer_compress(kmer)
 --     RETURNS text
@@ -186,12 +529,12 @@ CREATE FUNCTION spgist_kmer_leaf_consistent(internal, internal)
 CREATE OR REPLACE FUNCTION qkmer(text)
     RETURNS qkmer
     AS 'MODULE_PATHNAME', 'qkmer_cast_from_text'
-    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 10;
 
 CREATE OR REPLACE FUNCTION text(qkmer)
     RETURNS text
     AS 'MODULE_PATHNAME', 'qkmer_cast_to_text'
-    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 5;
 
 CREATE CAST (text as qkmer) WITH FUNCTION qkmer(text) AS IMPLICIT;
 CREATE CAST (qkmer as text) WITH FUNCTION text(qkmer);
@@ -199,22 +542,220 @@ CREATE CAST (qkmer as text) WITH FUNCTION text(qkmer);
 CREATE FUNCTION qkmer(int, text)
     RETURNS qkmer
     AS 'MODULE_PATHNAME', 'qkmer_constructor'
-    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 10;
 
 CREATE FUNCTION length(qkmer)
     RETURNS int
     AS 'MODULE_PATHNAME', 'qkmer_length'
-    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 1;
 
 CREATE FUNCTION contains(qkmer, kmer)
     RETURNS boolean
     AS 'MODULE_PATHNAME', 'qkmer_contains'
-    LANGUAGE C IMMUTABLE STRICT PARALLEL RESTRICTED;
+    LANGUAGE C IMMUTABLE STRICT PARALLEL RESTRICTED COST 2;
 
 CREATE FUNCTION contains_swapped(kmer, qkmer)
     RETURNS boolean
     AS 'MODULE_PATHNAME', 'qkmer_contains_swapped'
-    LANGUAGE C IMMUTABLE STRICT PARALLEL RESTRICTED;
+    LANGUAGE C IMMUTABLE STRICT PARALLEL RESTRICTED COST 2;
+
+-- ********** dna_sketch **********
+-- Bottom-s sketch of the canonical k-mers by default; size => 0 with
+-- scaled => n gives a FracMinHash sketch keeping about 1/n of the k-mers
+CREATE FUNCTION sketch(dna, k integer DEFAULT 21, size integer DEFAULT 1000, scaled bigint DEFAULT 1)
+    RETURNS dna_sketch
+    AS 'MODULE_PATHNAME', 'dna_sketch_build'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 1000;
+
+CREATE FUNCTION length(dna_sketch)
+    RETURNS int
+    AS 'MODULE_PATHNAME', 'dna_sketch_length'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 1;
+
+CREATE FUNCTION jaccard(dna_sketch, dna_sketch)
+    RETURNS float8
+    AS 'MODULE_PATHNAME', 'dna_sketch_jaccard'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 100;
+
+-- Fraction of the k-mers of the first sketch contained in the second
+CREATE FUNCTION containment(dna_sketch, dna_sketch)
+    RETURNS float8
+    AS 'MODULE_PATHNAME', 'dna_sketch_containment'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 100;
+
+CREATE FUNCTION mash_distance(dna_sketch, dna_sketch)
+    RETURNS float8
+    AS 'MODULE_PATHNAME', 'dna_sketch_mash_distance'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 100;
+
+/* Functions for the sketch_agg aggregate */
+CREATE FUNCTION sketch_agg_transfn(internal, dna, integer)
+    RETURNS internal
+    AS 'MODULE_PATHNAME', 'sketch_agg_transfn'
+    LANGUAGE C IMMUTABLE PARALLEL SAFE COST 1000;
+
+CREATE FUNCTION sketch_agg_transfn(internal, dna, integer, integer, bigint)
+    RETURNS internal
+    AS 'MODULE_PATHNAME', 'sketch_agg_transfn'
+    LANGUAGE C IMMUTABLE PARALLEL SAFE COST 1000;
+
+CREATE FUNCTION sketch_agg_combinefn(internal, internal)
+    RETURNS internal
+    AS 'MODULE_PATHNAME', 'sketch_agg_combinefn'
+    LANGUAGE C IMMUTABLE PARALLEL SAFE COST 100;
+
+CREATE FUNCTION sketch_agg_serialfn(internal)
+    RETURNS bytea
+    AS 'MODULE_PATHNAME', 'sketch_agg_serialfn'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 100;
+
+CREATE FUNCTION sketch_agg_deserialfn(bytea, internal)
+    RETURNS internal
+    AS 'MODULE_PATHNAME', 'sketch_agg_deserialfn'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 100;
+
+CREATE FUNCTION sketch_agg_finalfn(internal)
+    RETURNS dna_sketch
+    AS 'MODULE_PATHNAME', 'sketch_agg_finalfn'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 100;
+
+-- One sketch over the k-mers of all rows, with 1000 hashes
+CREATE AGGREGATE sketch_agg(dna, integer) (
+    SFUNC        = sketch_agg_transfn,
+    STYPE        = internal,
+    FINALFUNC    = sketch_agg_finalfn,
+    COMBINEFUNC  = sketch_agg_combinefn,
+    SERIALFUNC   = sketch_agg_serialfn,
+    DESERIALFUNC = sketch_agg_deserialfn,
+    PARALLEL     = SAFE
+);
+
+-- Same with explicit size and scaled, as for sketch()
+CREATE AGGREGATE sketch_agg(dna, integer, integer, bigint) (
+    SFUNC        = sketch_agg_transfn,
+    STYPE        = internal,
+    FINALFUNC    = sketch_agg_finalfn,
+    COMBINEFUNC  = sketch_agg_combinefn,
+    SERIALFUNC   = sketch_agg_serialfn,
+    DESERIALFUNC = sketch_agg_deserialfn,
+    PARALLEL     = SAFE
+);
+
+-- ********** hll **********
+-- 2^log2m registers (the precision); the standard error is 1.04 / sqrt(2^log2m)
+CREATE FUNCTION kmer_hll(dna, k integer, log2m integer DEFAULT 14)
+    RETURNS hll
+    AS 'MODULE_PATHNAME', 'kmer_hll'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 1000;
+
+CREATE FUNCTION cardinality(hll)
+    RETURNS bigint
+    AS 'MODULE_PATHNAME', 'hll_cardinality'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 100;
+
+CREATE FUNCTION hll_union(hll, hll)
+    RETURNS hll
+    AS 'MODULE_PATHNAME', 'hll_union'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 100;
+
+/* Functions for the hll_agg, approx_distinct_kmers and hll_union_agg aggregates */
+CREATE FUNCTION hll_agg_transfn(internal, dna, integer)
+    RETURNS internal
+    AS 'MODULE_PATHNAME', 'hll_agg_transfn'
+    LANGUAGE C IMMUTABLE PARALLEL SAFE COST 1000;
+
+CREATE FUNCTION hll_agg_transfn(internal, dna, integer, integer)
+    RETURNS internal
+    AS 'MODULE_PATHNAME', 'hll_agg_transfn'
+    LANGUAGE C IMMUTABLE PARALLEL SAFE COST 1000;
+
+CREATE FUNCTION hll_union_agg_transfn(internal, hll)
+    RETURNS internal
+    AS 'MODULE_PATHNAME', 'hll_union_agg_transfn'
+    LANGUAGE C IMMUTABLE PARALLEL SAFE COST 100;
+
+CREATE FUNCTION hll_agg_combinefn(internal, internal)
+    RETURNS internal
+    AS 'MODULE_PATHNAME', 'hll_agg_combinefn'
+    LANGUAGE C IMMUTABLE PARALLEL SAFE COST 100;
+
+CREATE FUNCTION hll_agg_serialfn(internal)
+    RETURNS bytea
+    AS 'MODULE_PATHNAME', 'hll_agg_serialfn'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 100;
+
+CREATE FUNCTION hll_agg_deserialfn(bytea, internal)
+    RETURNS internal
+    AS 'MODULE_PATHNAME', 'hll_agg_deserialfn'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 100;
+
+CREATE FUNCTION hll_agg_finalfn(internal)
+    RETURNS hll
+    AS 'MODULE_PATHNAME', 'hll_agg_finalfn'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 10;
+
+CREATE FUNCTION approx_distinct_kmers_finalfn(internal)
+    RETURNS bigint
+    AS 'MODULE_PATHNAME', 'approx_distinct_kmers_finalfn'
+    LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE COST 100;
+
+-- Estimated number of distinct k-mers over all rows, in one pass and 16 KB
+CREATE AGGREGATE approx_distinct_kmers(dna, integer) (
+    SFUNC        = hll_agg_transfn,
+    STYPE        = internal,
+    FINALFUNC    = approx_distinct_kmers_finalfn,
+    COMBINEFUNC  = hll_agg_combinefn,
+    SERIALFUNC   = hll_agg_serialfn,
+    DESERIALFUNC = hll_agg_deserialfn,
+    PARALLEL     = SAFE
+);
+
+-- The same state kept as an hll, to store and union later
+CREATE AGGREGATE hll_agg(dna, integer) (
+    SFUNC        = hll_agg_transfn,
+    STYPE        = internal,
+    FINALFUNC    = hll_agg_finalfn,
+    COMBINEFUNC  = hll_agg_combinefn,
+    SERIALFUNC   = hll_agg_serialfn,
+    DESERIALFUNC = hll_agg_deserialfn,
+    PARALLEL     = SAFE
+);
+
+CREATE AGGREGATE hll_agg(dna, integer, integer) (
+    SFUNC        = hll_agg_transfn,
+    STYPE        = internal,
+    FINALFUNC    = hll_agg_finalfn,
+    COMBINEFUNC  = hll_agg_combinefn,
+    SERIALFUNC   = hll_agg_serialfn,
+    DESERIALFUNC = hll_agg_deserialfn,
+    PARALLEL     = SAFE
+);
+
+CREATE AGGREGATE hll_union_agg(hll) (
+    SFUNC        = hll_union_agg_transfn,
+    STYPE        = internal,
+    FINALFUNC    = hll_agg_finalfn,
+    COMBINEFUNC  = hll_agg_combinefn,
+    SERIALFUNC   = hll_agg_serialfn,
+    DESERIALFUNC = hll_agg_deserialfn,
+    PARALLEL     = SAFE
+);
+
+/******************************************************************************
+ * OPERATORS (dna)
+ ******************************************************************************/
+
+CREATE OPERATOR @> (
+    LEFTARG = dna, RIGHTARG = kmer,
+    PROCEDURE = contains,
+    RESTRICT = matchingsel, JOIN = matchingjoinsel
+);
+
+CREATE OPERATOR @> (
+    LEFTARG = dna, RIGHTARG = qkmer,
+    PROCEDURE = contains,
+    RESTRICT = matchingsel, JOIN = matchingjoinsel
+);
 
 /******************************************************************************
  * OPERATORS (kmer)
@@ -224,39 +765,57 @@ CREATE OPERATOR = (
     LEFTARG = kmer, RIGHTARG = kmer,
     PROCEDURE = equals,
     COMMUTATOR = =,
+    RESTRICT = eqsel, JOIN = eqjoinsel,
     HASHES
 );
 
 CREATE OPERATOR ^@ (
     LEFTARG = kmer, RIGHTARG = kmer,
-    PROCEDURE = kmer_starts_with_swapped
-    -- RESTRICT = kmer_starts_with_sel
-    -- ? Commutator?
+    PROCEDURE = kmer_starts_with_swapped,
+    RESTRICT = kmer_starts_with_sel, JOIN = matchingjoinsel
+);
+
+CREATE OPERATOR <-> (
+    LEFTARG = kmer, RIGHTARG = kmer,
+    PROCEDURE = hamming_distance,
+    COMMUTATOR = <->
+);
+
+/* True when the Hamming distance is at most dnasequence.hamming_threshold */
+CREATE OPERATOR % (
+    LEFTARG = kmer, RIGHTARG = kmer,
+    PROCEDURE = hamming_similar,
+    COMMUTATOR = %,
+    RESTRICT = matchingsel, JOIN = matchingjoinsel
 );
 
 /* Additional operators for the BTree operator class */
 CREATE OPERATOR < (
     LEFTARG = kmer, RIGHTARG = kmer,
     PROCEDURE = kmer_lt,
-    COMMUTATOR = >, NEGATOR = >=
+    COMMUTATOR = >, NEGATOR = >=,
+    RESTRICT = scalarltsel, JOIN = scalarltjoinsel
 );
 
 CREATE OPERATOR <= (
     LEFTARG = kmer, RIGHTARG = kmer,
     PROCEDURE = kmer_le,
-    COMMUTATOR = >=, NEGATOR = >
+    COMMUTATOR = >=, NEGATOR = >,
+    RESTRICT = scalarlesel, JOIN = scalarlejoinsel
 );
 
 CREATE OPERATOR > (
     LEFTARG = kmer, RIGHTARG = kmer,
     PROCEDURE = kmer_gt,
-    COMMUTATOR = <, NEGATOR = <=
+    COMMUTATOR = <, NEGATOR = <=,
+    RESTRICT = scalargtsel, JOIN = scalargtjoinsel
 );
 
 CREATE OPERATOR >= (
     LEFTARG = kmer, RIGHTARG = kmer,
     PROCEDURE = kmer_ge,
-    COMMUTATOR = <=, NEGATOR = <
+    COMMUTATOR = <=, NEGATOR = <,
+    RESTRICT = scalargesel, JOIN = scalargejoinsel
 );
 
 /******************************************************************************
@@ -266,15 +825,43 @@ CREATE OPERATOR >= (
 CREATE OPERATOR @> (
     LEFTARG = qkmer, RIGHTARG = kmer,
     COMMUTATOR = <@,
-    PROCEDURE = contains
+    PROCEDURE = contains,
+    RESTRICT = kmer_contains_sel, JOIN = matchingjoinsel
 );
 
 CREATE OPERATOR <@ (
     LEFTARG = kmer, RIGHTARG = qkmer,
     COMMUTATOR = @>,
-    PROCEDURE = contains_swapped
+    PROCEDURE = contains_swapped,
+    RESTRICT = kmer_contained_sel, JOIN = matchingjoinsel
 );
 
+/******************************************************************************
+ * OPERATORS (dna_sketch)
+ ******************************************************************************/
+
+CREATE OPERATOR <-> (
+    LEFTARG = dna_sketch, RIGHTARG = dna_sketch,
+    PROCEDURE = mash_distance,
+    COMMUTATOR = <->
+);
+
+/******************************************************************************
+ * OPERATOR CLASS (dna)
+ ******************************************************************************/
+-- Inverted index on the k-mers of each sequence, e.g. USING gin (seq dna_gin_ops (k = 16))
+CREATE OPERATOR CLASS dna_gin_ops
+    DEFAULT FOR TYPE dna USING gin AS
+        OPERATOR        1       @>(dna, kmer),
+        OPERATOR        2       @>(dna, qkmer),
+        FUNCTION        1       btint8cmp(int8, int8),
+        FUNCTION        2       dna_gin_extract_value(dna, internal),
+        FUNCTION        3       dna_gin_extract_query(dna, internal, int2, internal, internal, internal, internal),
+        FUNCTION        4       dna_gin_consistent(internal, int2, dna, int4, internal, internal, internal, internal),
+        FUNCTION        6       dna_gin_triconsistent(internal, int2, dna, int4, internal, internal, internal),
+        FUNCTION        7       dna_gin_options(internal),
+        STORAGE         int8;
+
 /******************************************************************************
  * OPERATOR CLASS (kmer)
  ******************************************************************************/
@@ -285,12 +872,14 @@ CREATE OPERATOR CLASS kmer_ops
         OPERATOR        3       = ,
         OPERATOR        4       >= ,
         OPERATOR        5       > ,
-        FUNCTION        1       kmer_cmp(kmer, kmer);
+        FUNCTION        1       kmer_cmp(kmer, kmer),
+        FUNCTION        2       kmer_sortsupport(internal);
 
 CREATE OPERATOR CLASS kmer_hash_ops
     DEFAULT FOR TYPE kmer USING hash AS
         OPERATOR        1       = (kmer, kmer),
-        FUNCTION        1       kmer_hash(kmer);
+        FUNCTION        1       kmer_hash(kmer),
+        FUNCTION        2       kmer_hash_extended(kmer, bigint);
 
 CREATE OPERATOR CLASS kmer_spgist_ops
     DEFAULT FOR TYPE kmer USING spgist AS
@@ -298,9 +887,37 @@ CREATE OPERATOR CLASS kmer_spgist_ops
         OPERATOR        2       ^@(kmer, kmer),
         OPERATOR        3       @>(qkmer, kmer),
         OPERATOR        3       <@(kmer, qkmer),
+        OPERATOR        4       %(kmer, kmer),
+        OPERATOR        5       <->(kmer, kmer) FOR ORDER BY float_ops,
         FUNCTION        1       spgist_kmer_config(internal, internal),
         FUNCTION        2       spgist_kmer_choose(internal, internal),
         FUNCTION        3       spgist_kmer_picksplit(internal, internal),
         FUNCTION        4       spgist_kmer_inner_consistent(internal, internal),
         FUNCTION        5       spgist_kmer_leaf_consistent(internal, internal),
         STORAGE         kmer;
+
+-- Block range summaries; minmax follows the kmer_ops order, bloom the kmer hash
+CREATE OPERATOR CLASS kmer_minmax_ops
+    DEFAULT FOR TYPE kmer USING brin AS
+        OPERATOR        1       < ,
+        OPERATOR        2       <= ,
+        OPERATOR        3       = ,
+        OPERATOR        4       >= ,
+        OPERATOR        5       > ,
+        OPERATOR        6       ^@(kmer, kmer),
+        FUNCTION        1       brin_minmax_opcinfo(internal),
+        FUNCTION        2       brin_minmax_add_value(internal, internal, internal, internal),
+        FUNCTION        3       kmer_brin_minmax_consistent(internal, internal, internal),
+        FUNCTION        4       brin_minmax_union(internal, internal, internal),
+        STORAGE         kmer;
+
+CREATE OPERATOR CLASS kmer_bloom_ops
+    FOR TYPE kmer USING brin AS
+        OPERATOR        1       = (kmer, kmer),
+        FUNCTION        1       brin_bloom_opcinfo(internal),
+        FUNCTION        2       brin_bloom_add_value(internal, internal, internal, internal),
+        FUNCTION        3       brin_bloom_consistent(internal, internal, internal, int4),
+        FUNCTION        4       brin_bloom_union(internal, internal, internal),
+        FUNCTION        5       brin_bloom_options(internal),
+        FUNCTION        11      kmer_hash(kmer),
+        STORAGE         kmer;
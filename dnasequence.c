@@ -2,6 +2,32 @@
 
 PG_MODULE_MAGIC;
 
+int hamming_threshold = 2;
+
+void _PG_init(void);
+
+/*
+ * Module load callback
+ */
+void
+_PG_init(void)
+{
+    DefineCustomIntVariable("dnasequence.hamming_threshold",
+                            "Sets the Hamming distance threshold used by the % operator.",
+                            "Valid range is 0 .. 32.",
+                            &hamming_threshold,
+                            2,
+                            0,
+                            MAX_KMER_LEN,
+                            PGC_USERSET,
+                            0,
+                            NULL,
+                            NULL,
+                            NULL);
+
+    MarkGUCPrefixReserved("dnasequence");
+}
+
 /******************************************************************************
  * INPUT/OUTPUT ROUTINES
  ******************************************************************************/
@@ -9,47 +35,106 @@ PG_MODULE_MAGIC;
 // ********** dna **********
 PG_FUNCTION_INFO_V1(dna_in);
 PG_FUNCTION_INFO_V1(dna_out);
+PG_FUNCTION_INFO_V1(dna_recv);
+PG_FUNCTION_INFO_V1(dna_send);
 
 // ********** kmer **********
 PG_FUNCTION_INFO_V1(kmer_in);
 PG_FUNCTION_INFO_V1(kmer_out);
+PG_FUNCTION_INFO_V1(kmer_recv);
+PG_FUNCTION_INFO_V1(kmer_send);
 PG_FUNCTION_INFO_V1(kmer_cast_from_text);
 PG_FUNCTION_INFO_V1(kmer_cast_to_text);
 
 // ********** qkmer **********
 PG_FUNCTION_INFO_V1(qkmer_in);
 PG_FUNCTION_INFO_V1(qkmer_out);
+PG_FUNCTION_INFO_V1(qkmer_recv);
+PG_FUNCTION_INFO_V1(qkmer_send);
 PG_FUNCTION_INFO_V1(qkmer_cast_from_text);
 PG_FUNCTION_INFO_V1(qkmer_cast_to_text);
 
+// ********** dna_sketch **********
+PG_FUNCTION_INFO_V1(dna_sketch_in);
+PG_FUNCTION_INFO_V1(dna_sketch_out);
+PG_FUNCTION_INFO_V1(dna_sketch_recv);
+PG_FUNCTION_INFO_V1(dna_sketch_send);
+
+// ********** hll **********
+PG_FUNCTION_INFO_V1(hll_in);
+PG_FUNCTION_INFO_V1(hll_out);
+PG_FUNCTION_INFO_V1(hll_recv);
+PG_FUNCTION_INFO_V1(hll_send);
+
 /******************************************************************************
  * FUNCTIONS
  ******************************************************************************/
 
 // ********** dna **********
 PG_FUNCTION_INFO_V1(dna_length);
+PG_FUNCTION_INFO_V1(dna_substring);
+PG_FUNCTION_INFO_V1(dna_reverse_complement);
+PG_FUNCTION_INFO_V1(dna_contains_kmer);
+PG_FUNCTION_INFO_V1(dna_contains_qkmer);
+PG_FUNCTION_INFO_V1(read_fasta);
+PG_FUNCTION_INFO_V1(read_fastq);
+PG_FUNCTION_INFO_V1(dnasequence_fdw_handler);
+PG_FUNCTION_INFO_V1(dnasequence_fdw_validator);
+// Additional functions for the GIN operator class
+PG_FUNCTION_INFO_V1(dna_gin_options);
+PG_FUNCTION_INFO_V1(dna_gin_extract_value);
+PG_FUNCTION_INFO_V1(dna_gin_extract_query);
+PG_FUNCTION_INFO_V1(dna_gin_consistent);
+PG_FUNCTION_INFO_V1(dna_gin_triconsistent);
 
 // ********** kmer **********
 PG_FUNCTION_INFO_V1(kmer_constructor);
 PG_FUNCTION_INFO_V1(kmer_length);
+PG_FUNCTION_INFO_V1(kmer_reverse_complement);
+PG_FUNCTION_INFO_V1(kmer_canonical);
 PG_FUNCTION_INFO_V1(kmer_equals);
 PG_FUNCTION_INFO_V1(kmer_starts_with);
 PG_FUNCTION_INFO_V1(kmer_starts_with_swapped);
+PG_FUNCTION_INFO_V1(kmer_starts_with_support);
+PG_FUNCTION_INFO_V1(kmer_starts_with_swapped_support);
+PG_FUNCTION_INFO_V1(kmer_distance);
+PG_FUNCTION_INFO_V1(kmer_similar);
 PG_FUNCTION_INFO_V1(generate_kmers);
+PG_FUNCTION_INFO_V1(kmer_count);
+PG_FUNCTION_INFO_V1(generate_minimizers);
+PG_FUNCTION_INFO_V1(generate_syncmers);
+PG_FUNCTION_INFO_V1(generate_kmers_support);
+PG_FUNCTION_INFO_V1(kmer_count_support);
+// Functions for the kmer_spectrum aggregate
+PG_FUNCTION_INFO_V1(kmer_spectrum_transfn);
+PG_FUNCTION_INFO_V1(kmer_spectrum_combinefn);
+PG_FUNCTION_INFO_V1(kmer_spectrum_serialfn);
+PG_FUNCTION_INFO_V1(kmer_spectrum_deserialfn);
+PG_FUNCTION_INFO_V1(kmer_spectrum_finalfn);
 // Additional functions for the BTree operator class
 PG_FUNCTION_INFO_V1(kmer_lt);
 PG_FUNCTION_INFO_V1(kmer_le);
 PG_FUNCTION_INFO_V1(kmer_gt);
 PG_FUNCTION_INFO_V1(kmer_ge);
 PG_FUNCTION_INFO_V1(kmer_cmp);
+PG_FUNCTION_INFO_V1(kmer_sortsupport);
 // Additional functions for the hash operator class
 PG_FUNCTION_INFO_V1(kmer_hash);
+PG_FUNCTION_INFO_V1(kmer_hash_extended);
+// Statistics and selectivity estimators
+PG_FUNCTION_INFO_V1(dna_typanalyze);
+PG_FUNCTION_INFO_V1(kmer_typanalyze);
+PG_FUNCTION_INFO_V1(kmer_starts_with_sel);
+PG_FUNCTION_INFO_V1(kmer_contains_sel);
+PG_FUNCTION_INFO_V1(kmer_contained_sel);
 // Additional functions for the SP-GiST operator class
 PG_FUNCTION_INFO_V1(spgist_kmer_config);
 PG_FUNCTION_INFO_V1(spgist_kmer_choose);
 PG_FUNCTION_INFO_V1(spgist_kmer_picksplit);
 PG_FUNCTION_INFO_V1(spgist_kmer_inner_consistent);
 PG_FUNCTION_INFO_V1(spgist_kmer_leaf_consistent);
+// Additional functions for the BRIN operator classes
+PG_FUNCTION_INFO_V1(kmer_brin_minmax_consistent);
 
 // ********** qkmer **********
 PG_FUNCTION_INFO_V1(qkmer_constructor);
@@ -57,6 +142,32 @@ PG_FUNCTION_INFO_V1(qkmer_length);
 PG_FUNCTION_INFO_V1(qkmer_contains);
 PG_FUNCTION_INFO_V1(qkmer_contains_swapped);
 
+// ********** dna_sketch **********
+PG_FUNCTION_INFO_V1(dna_sketch_build);
+PG_FUNCTION_INFO_V1(dna_sketch_length);
+PG_FUNCTION_INFO_V1(dna_sketch_jaccard);
+PG_FUNCTION_INFO_V1(dna_sketch_containment);
+PG_FUNCTION_INFO_V1(dna_sketch_mash_distance);
+// Functions for the sketch_agg aggregate
+PG_FUNCTION_INFO_V1(sketch_agg_transfn);
+PG_FUNCTION_INFO_V1(sketch_agg_combinefn);
+PG_FUNCTION_INFO_V1(sketch_agg_serialfn);
+PG_FUNCTION_INFO_V1(sketch_agg_deserialfn);
+PG_FUNCTION_INFO_V1(sketch_agg_finalfn);
+
+// ********** hll **********
+PG_FUNCTION_INFO_V1(kmer_hll);
+PG_FUNCTION_INFO_V1(hll_cardinality);
+PG_FUNCTION_INFO_V1(hll_union);
+// Functions for the hll_agg, approx_distinct_kmers and hll_union_agg aggregates
+PG_FUNCTION_INFO_V1(hll_agg_transfn);
+PG_FUNCTION_INFO_V1(hll_union_agg_transfn);
+PG_FUNCTION_INFO_V1(hll_agg_combinefn);
+PG_FUNCTION_INFO_V1(hll_agg_serialfn);
+PG_FUNCTION_INFO_V1(hll_agg_deserialfn);
+PG_FUNCTION_INFO_V1(hll_agg_finalfn);
+PG_FUNCTION_INFO_V1(approx_distinct_kmers_finalfn);
+
 /******************************************************************************
  * IMPLEMENTATION
  ******************************************************************************/
@@ -76,355 +187,2430 @@ dna_in(PG_FUNCTION_ARGS) {
 Datum
 dna_out(PG_FUNCTION_ARGS) {
     dna *seq = PG_GETARG_DNA_P(0);
-    char *result = pstrdup(seq->sequence);
+    char *result = dna_to_string(seq);
     PG_FREE_IF_COPY(seq, 0);
     PG_RETURN_CSTRING(result);
 }
 
+/*
+ * Binary format: the number of bases and of exception runs (int32 each), the
+ * packed bases as stored, then every run as its start and length (int32) and
+ * its base (byte)
+ */
 Datum
-dna_length(PG_FUNCTION_ARGS) {
-    dna *seq = PG_GETARG_DNA_P(0);
-    PG_RETURN_INT32(seq->length);
+dna_recv(PG_FUNCTION_ARGS) {
+    StringInfo buf = (StringInfo) PG_GETARG_POINTER(0);
+    int32 length = pq_getmsgint(buf, 4);
+    int32 nexceptions = pq_getmsgint(buf, 4);
+    int64 packed = DNA_PACKED_SIZE((int64) length);
+    int64 end = 0;
+    dna *result;
+    dna_exception *exc;
+
+    if (length < 0 || nexceptions < 0 ||
+        packed + (int64) nexceptions * 9 > buf->len - buf->cursor)
+        ereport(ERROR, (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+                        errmsg("invalid external dna value")));
+
+    result = dna_alloc(length, nexceptions);
+    pq_copymsgbytes(buf, (char *) result->bases, packed);
+    /* Bits past the last base must be zero for comparisons and hashing */
+    if ((length & 3) != 0 && (result->bases[packed - 1] & (0xFF >> (2 * (length & 3)))) != 0)
+        ereport(ERROR, (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+                        errmsg("invalid external dna value")));
+
+    exc = DNA_EXCEPTIONS(result);
+    for (int e = 0; e < nexceptions; e++) {
+        exc[e].start = pq_getmsgint(buf, 4);
+        exc[e].length = pq_getmsgint(buf, 4);
+        exc[e].base = pq_getmsgbyte(buf);
+        if (exc[e].start < end || exc[e].length <= 0 ||
+            (int64) exc[e].start + exc[e].length > length ||
+            exc[e].base == '\0' || strchr(DNA_EXCEPTION_BASES, exc[e].base) == NULL)
+            ereport(ERROR, (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+                            errmsg("invalid external dna value")));
+        end = (int64) exc[e].start + exc[e].length;
+        for (int i = exc[e].start; i < end; i++) {
+            if (DNA_BASE_AT(result, i) != 0)
+                ereport(ERROR, (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+                                errmsg("invalid external dna value")));
+        }
+    }
+    PG_RETURN_DNA_P(result);
 }
 
-// ********** kmer **********
 Datum
-kmer_in(PG_FUNCTION_ARGS) {
-    char *str = PG_GETARG_CSTRING(0);
-    if (str == NULL || strlen(str) == 0) {
-        ereport(ERROR,
-                (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
-                 errmsg("Input to kmer type cannot be NULL or empty")));
+dna_send(PG_FUNCTION_ARGS) {
+    dna *seq = PG_GETARG_DNA_P(0);
+    const dna_exception *exc = DNA_EXCEPTIONS(seq);
+    StringInfoData buf;
+
+    pq_begintypsend(&buf);
+    pq_sendint32(&buf, seq->length);
+    pq_sendint32(&buf, seq->nexceptions);
+    pq_sendbytes(&buf, seq->bases, DNA_PACKED_SIZE(seq->length));
+    for (int e = 0; e < seq->nexceptions; e++) {
+        pq_sendint32(&buf, exc[e].start);
+        pq_sendint32(&buf, exc[e].length);
+        pq_sendbyte(&buf, exc[e].base);
     }
-    PG_RETURN_KMER_P(kmer_parse(str));
+    PG_FREE_IF_COPY(seq, 0);
+    PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
 }
 
+/*
+ * The length is in the header, so only the first bytes of a toasted value are
+ * fetched
+ */
 Datum
-kmer_out(PG_FUNCTION_ARGS) {
-    kmer *c = PG_GETARG_KMER_P(0);
-    char *result = pstrdup(c->data);
-    PG_FREE_IF_COPY(c, 0);
-    PG_RETURN_CSTRING(result);
+dna_length(PG_FUNCTION_ARGS) {
+    dna *header = PG_GETARG_DNA_HEADER(0);
+    PG_RETURN_INT32(header->length);
 }
 
+/*
+ * Bases [start, start + count) of a sequence, counting from 1 and clipped to
+ * the sequence as substring(text) does. A window with no bases gives NULL,
+ * since a dna value cannot be empty. Only the header, the packed bytes under
+ * the window and the exception list are fetched, so with the external storage
+ * of the type the cost follows the window, not the sequence.
+ */
 Datum
-kmer_cast_from_text(PG_FUNCTION_ARGS) {
-    text *txt = PG_GETARG_TEXT_P(0);
-    char *str = DatumGetCString(DirectFunctionCall1(textout, PointerGetDatum(txt)));
-    PG_RETURN_KMER_P(kmer_parse(str));
-}
+dna_substring(PG_FUNCTION_ARGS) {
+    int32 start = PG_GETARG_INT32(1);
+    int32 count = PG_GETARG_INT32(2);
+    dna *header;
+    const uint8 *bases;
+    dna *result;
+    const dna_exception *exc = NULL;
+    dna_exception *rexc;
+    int64 from;
+    int64 to;
+    int n;
+    int first;
+    int shift;
+    int nexceptions = 0;
+
+    if (count < 0)
+        ereport(ERROR, (errcode(ERRCODE_SUBSTRING_ERROR),
+                        errmsg("negative substring length not allowed")));
+
+    header = PG_GETARG_DNA_HEADER(0);
+    from = Max((int64) start - 1, 0);
+    to = Min((int64) start - 1 + count, header->length);
+    if (to <= from)
+        PG_RETURN_NULL();
+    n = to - from;
+
+    first = from >> 2;
+    bases = PG_GETARG_DNA_BYTES(0, first, DNA_PACKED_SIZE(to) - first);
+    if (header->nexceptions > 0) {
+        /* The runs follow the int-aligned packed bases */
+        exc = (dna_exception *) PG_GETARG_DNA_BYTES(0, INTALIGN(DNA_PACKED_SIZE(header->length)),
+                                                    header->nexceptions * sizeof(dna_exception));
+        for (int e = 0; e < header->nexceptions; e++) {
+            if (exc[e].start < to && exc[e].start + exc[e].length > from)
+                nexceptions++;
+        }
+    }
 
-Datum
-kmer_cast_to_text(PG_FUNCTION_ARGS) {
-    kmer *c = PG_GETARG_KMER_P(0);
-    text *out = (text *)DirectFunctionCall1(textin, PointerGetDatum(kmer_to_str(c)));
-    PG_FREE_IF_COPY(c, 0);
-    PG_RETURN_TEXT_P(out);
-}
+    result = dna_alloc(n, nexceptions);
+    /* Shift the bases of the first byte that are before the window out */
+    shift = 2 * (from & 3);
+    for (int i = 0; i < DNA_PACKED_SIZE(n); i++) {
+        uint8 byte = (uint8) (bases[i] << shift);
 
-// Ref: https://doxygen.postgresql.org/varlena_8c.html#a7777d194920e57222a17b02166fc7232
-Datum
-kmer_constructor(PG_FUNCTION_ARGS) {
-    int k = PG_GETARG_INT32(0);
-    char *data = text_to_cstring(PG_GETARG_TEXT_PP(1));
-    PG_RETURN_KMER_P(kmer_make(k, data));
+        if (shift > 0 && first + i + 1 < DNA_PACKED_SIZE(to))
+            byte |= bases[i + 1] >> (8 - shift);
+        result->bases[i] = byte;
+    }
+    if ((n & 3) != 0)
+        result->bases[DNA_PACKED_SIZE(n) - 1] &= (uint8) (0xFF << (8 - 2 * (n & 3)));
+
+    rexc = DNA_EXCEPTIONS(result);
+    for (int e = 0; e < header->nexceptions; e++) {
+        int64 s = Max(exc[e].start, from);
+        int64 end = Min(exc[e].start + exc[e].length, to);
+
+        if (s < end) {
+            rexc->start = s - from;
+            rexc->length = end - s;
+            rexc->base = exc[e].base;
+            rexc++;
+        }
+    }
+    PG_RETURN_DNA_P(result);
 }
 
 Datum
-kmer_length(PG_FUNCTION_ARGS) {
-    kmer *c = PG_GETARG_KMER_P(0);
-    int k = c->k;
-    PG_FREE_IF_COPY(c, 0);
-    PG_RETURN_INT32(k);
+dna_reverse_complement(PG_FUNCTION_ARGS) {
+    dna *seq = PG_GETARG_DNA_P(0);
+    dna *result = dna_reverse_complement_internal(seq);
+    PG_FREE_IF_COPY(seq, 0);
+    PG_RETURN_DNA_P(result);
 }
 
+/*
+ * Check whether the sequence contains the kmer, sliding a window of its length
+ */
 Datum
-kmer_equals(PG_FUNCTION_ARGS) {
-    kmer *a = PG_GETARG_KMER_P(0);
-    kmer *b = PG_GETARG_KMER_P(1);
-    bool result;
-    if (a->k != b->k) {
-        result = false;
+dna_contains_kmer(PG_FUNCTION_ARGS) {
+    dna *seq = PG_GETARG_DNA_P(0);
+    kmer *query = PG_GETARG_KMER_P(1);
+    dna_kmer_iter it;
+    uint64 code;
+    int start;
+    bool result = false;
+
+    if (query->k == 0) {
+        result = true;
     } else {
-        result = kmer_cmp_internal(a, b) == 0;
+        dna_kmer_iter_init(&it, seq, query->k, false);
+        while (dna_kmer_iter_next(&it, &code, &start)) {
+            if (code == query->code) {
+                result = true;
+                break;
+            }
+        }
     }
-    PG_FREE_IF_COPY(a, 0);
-    PG_FREE_IF_COPY(b, 1);
+    PG_FREE_IF_COPY(seq, 0);
     PG_RETURN_BOOL(result);
 }
 
+/*
+ * Check whether some window of the sequence matches the pattern
+ */
 Datum
-kmer_starts_with(PG_FUNCTION_ARGS) {
-    kmer *prefix = PG_GETARG_KMER_P(0);
-    kmer *c = PG_GETARG_KMER_P(1);
-    bool result;
-    if (prefix->k > c->k) {
-        result = false;
+dna_contains_qkmer(PG_FUNCTION_ARGS) {
+    dna *seq = PG_GETARG_DNA_P(0);
+    qkmer *query = PG_GETARG_QKMER_P(1);
+    const qkmer_pattern *pattern = qkmer_cached_pattern(fcinfo->flinfo, query);
+    uint64 mask = KMER_MASK(query->k);
+    dna_kmer_iter it;
+    uint64 code;
+    int start;
+    bool result = false;
+
+    if (query->k == 0) {
+        result = true;
     } else {
-        result = starts_with(prefix->data, c->data);
+        dna_kmer_iter_init(&it, seq, query->k, false);
+        while (dna_kmer_iter_next(&it, &code, &start)) {
+            if (qkmer_pattern_matches(pattern, code, mask)) {
+                result = true;
+                break;
+            }
+        }
     }
-    PG_FREE_IF_COPY(prefix, 0);
-    PG_FREE_IF_COPY(c, 1);   
+    PG_FREE_IF_COPY(seq, 0);
     PG_RETURN_BOOL(result);
 }
 
-Datum
-kmer_starts_with_swapped(PG_FUNCTION_ARGS) {
-    kmer *c = PG_GETARG_KMER_P(0);
-    kmer *prefix = PG_GETARG_KMER_P(1);
-    bool result;
-    if (prefix->k > c->k) {
-        result = false;
-    } else {
-        result = starts_with(prefix->data, c->data);
-    }
-    PG_FREE_IF_COPY(prefix, 1);
-    PG_FREE_IF_COPY(c, 0);   
-    PG_RETURN_BOOL(result);
+// FASTA/FASTQ loading
+
+#define SEQ_READ_BUFSIZE    (1024 * 1024)
+
+/* Buffered reader over a server-side file */
+typedef struct {
+    FILE *file;
+    const char *path;
+    char *buf;
+    size_t len;         /* valid bytes in buf */
+    size_t pos;         /* next byte to consume */
+    int64 offset;       /* file offset of buf[0] */
+    int64 lineno;       /* number of lines consumed, -1 after seeking into the file */
+} seq_reader;
+
+/* File offset of the next byte to consume */
+#define SEQ_READER_TELL(r)  ((r)->offset + (int64) (r)->pos)
+
+static void seq_reader_open(seq_reader *r, const char *path) {
+    r->file = AllocateFile(path, PG_BINARY_R);
+    if (r->file == NULL)
+        ereport(ERROR, (errcode_for_file_access(),
+                        errmsg("could not open file \"%s\" for reading: %m", path)));
+    r->path = path;
+    r->buf = palloc(SEQ_READ_BUFSIZE);
+    r->len = 0;
+    r->pos = 0;
+    r->offset = 0;
+    r->lineno = 0;
 }
 
-Datum
-generate_kmers(PG_FUNCTION_ARGS) {    
-    FuncCallContext *funcctx;
-    int call_cntr;
-    int max_calls;
-    kmer *result_kmer;
-
-    dna *dna_sequence = PG_GETARG_DNA_P(0);
-    int k = PG_GETARG_INT32(1);
-    
-    if (SRF_IS_FIRSTCALL()) {        
-        funcctx = SRF_FIRSTCALL_INIT();
-        
-        MemoryContext oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
-
-        if (k <= 0 || k > dna_sequence->length || k > MAX_KMER_LEN) {
-            ereport(ERROR, (errmsg("Invalid k value: must be between 1 and min(sequence length, %d)", MAX_KMER_LEN)));
-        }
-
-        funcctx->max_calls = dna_sequence->length - k + 1;
-        funcctx->user_fctx = palloc(sizeof(dna));
-        memcpy(funcctx->user_fctx, dna_sequence, sizeof(dna));
-
-        MemoryContextSwitchTo(oldcontext);
-    }
+static void seq_reader_close(seq_reader *r) {
+    FreeFile(r->file);
+    pfree(r->buf);
+}
 
-    funcctx = SRF_PERCALL_SETUP();
+static bool seq_reader_fill(seq_reader *r) {
+    if (r->pos < r->len)
+        return true;
+    r->offset += r->len;
+    r->len = fread(r->buf, 1, SEQ_READ_BUFSIZE, r->file);
+    r->pos = 0;
+    if (r->len == 0 && ferror(r->file))
+        ereport(ERROR, (errcode_for_file_access(),
+                        errmsg("could not read file \"%s\": %m", r->path)));
+    return r->len > 0;
+}
 
-    call_cntr = funcctx->call_cntr;
-    max_calls = funcctx->max_calls;
+/* Next character without consuming it, or EOF */
+static int seq_reader_peek(seq_reader *r) {
+    return seq_reader_fill(r) ? (unsigned char) r->buf[r->pos] : EOF;
+}
 
-    if (call_cntr < max_calls) {        
-        dna *sequence = (dna *)funcctx->user_fctx;
-        char *kmer_data = palloc(k + 1);
-        strncpy(kmer_data, dna_sequence->sequence + call_cntr, k);
-        kmer_data[k] = '\0';
-        
-        result_kmer = kmer_make(k, kmer_data);
-        
-        pfree(kmer_data);
-        SRF_RETURN_NEXT(funcctx, KmerPGetDatum(result_kmer));
+/* Continue reading at a file offset, reusing the buffer when it holds it */
+static void seq_reader_seek(seq_reader *r, int64 off) {
+    if (off >= r->offset && off < r->offset + (int64) r->len) {
+        r->pos = off - r->offset;
     } else {
-        SRF_RETURN_DONE(funcctx);
+        if (fseeko(r->file, off, SEEK_SET) != 0)
+            ereport(ERROR, (errcode_for_file_access(),
+                            errmsg("could not seek in file \"%s\": %m", r->path)));
+        r->offset = off;
+        r->len = 0;
+        r->pos = 0;
     }
+    r->lineno = off == 0 ? 0 : -1;
 }
 
-// BTree functions
-Datum
-kmer_lt(PG_FUNCTION_ARGS) {
-    kmer *a = PG_GETARG_KMER_P(0);
-    kmer *b = PG_GETARG_KMER_P(1);
-    bool result;
-    if (a->k != b->k) {
-        result = a->k < b->k;
-    } else {
-        result = kmer_cmp_internal(a, b) < 0;
-    }
-    PG_FREE_IF_COPY(a, 0);
-    PG_FREE_IF_COPY(b, 1);
-    PG_RETURN_BOOL(result);
+/* Position of the next line for error messages */
+static char *seq_reader_location(seq_reader *r) {
+    if (r->lineno >= 0)
+        return psprintf("line %lld", (long long) r->lineno + 1);
+    return psprintf("byte offset %lld", (long long) SEQ_READER_TELL(r));
 }
 
-Datum
-kmer_le(PG_FUNCTION_ARGS) {
-    kmer *a = PG_GETARG_KMER_P(0);
-    kmer *b = PG_GETARG_KMER_P(1);
-    bool result;
-    if (a->k != b->k) {
-        result = a->k < b->k;
-    } else {
-        result = kmer_cmp_internal(a, b) <= 0;
+/*
+ * Consume one line, appending it (without the line break) to str, or packing
+ * it into builder, or dropping it when both are NULL. Lines are handed over in
+ * buffer-sized pieces, so a sequence line can be arbitrarily long.
+ */
+static void seq_reader_line(seq_reader *r, StringInfo str, dna_builder *builder) {
+    int start = str ? str->len : 0;
+
+    while (seq_reader_fill(r)) {
+        char *begin = r->buf + r->pos;
+        char *end = memchr(begin, '\n', r->len - r->pos);
+        size_t n = end ? end - begin : r->len - r->pos;
+
+        if (str)
+            appendBinaryStringInfo(str, begin, n);
+        else if (builder)
+            dna_builder_append(builder, begin, n, true);
+        r->pos += end ? n + 1 : n;
+        if (end)
+            break;
     }
-    PG_FREE_IF_COPY(a, 0);
-    PG_FREE_IF_COPY(b, 1);
-    PG_RETURN_BOOL(result);
+    if (r->lineno >= 0)
+        r->lineno++;
+    if (str && str->len > start && str->data[str->len - 1] == '\r')
+        str->data[--str->len] = '\0';
 }
 
-Datum
-kmer_gt(PG_FUNCTION_ARGS) {
-    kmer *a = PG_GETARG_KMER_P(0);
-    kmer *b = PG_GETARG_KMER_P(1);
-    bool result;
-    if (a->k != b->k) {
-        result = a->k > b->k;
-    } else {
-        result = kmer_cmp_internal(a, b) > 0;
-    }
-    PG_FREE_IF_COPY(a, 0);
-    PG_FREE_IF_COPY(b, 1);
-    PG_RETURN_BOOL(result);
+/*
+ * Read the next FASTA record into header and builder. Returns false at the end
+ * of the file, or without consuming it when the record starts at or past the
+ * file offset end.
+ */
+static bool seq_read_fasta_record(seq_reader *r, int64 end, StringInfo header,
+                                  dna_builder *builder) {
+    int c;
+
+    /* Blank lines and ';' comments may appear between records */
+    while ((c = seq_reader_peek(r)) == '\n' || c == '\r' || c == ';')
+        seq_reader_line(r, NULL, NULL);
+    if (c == EOF || SEQ_READER_TELL(r) >= end)
+        return false;
+    if (c != '>')
+        ereport(ERROR, (errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+                        errmsg("invalid FASTA file \"%s\": expected '>' at %s",
+                               r->path, seq_reader_location(r))));
+
+    resetStringInfo(header);
+    seq_reader_line(r, header, NULL);
+    while ((c = seq_reader_peek(r)) != EOF && c != '>')
+        seq_reader_line(r, NULL, c == ';' ? NULL : builder);
+    return true;
 }
 
-Datum
-kmer_ge(PG_FUNCTION_ARGS) {
-    kmer *a = PG_GETARG_KMER_P(0);
-    kmer *b = PG_GETARG_KMER_P(1);
-    bool result;
-    if (a->k != b->k) {
-        result = a->k > b->k;
-    } else {
-        result = kmer_cmp_internal(a, b) >= 0;
+/*
+ * Parallel scans find record starts with a rule that only holds when sequence
+ * and quality are on a single line each. They are only planned for files whose
+ * first records are laid out that way, and refuse a later multi-line record
+ * rather than skip records.
+ */
+static void seq_fastq_multiline_error(seq_reader *r, const char *where) {
+    ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                    errmsg("parallel scan of FASTQ file \"%s\" requires single-line records", r->path),
+                    errdetail("The record at %s spans several lines.", where),
+                    errhint("Disable parallel query for this scan, e.g. SET max_parallel_workers_per_gather = 0.")));
+}
+
+/*
+ * Read the next FASTQ record into header, builder and quality, with the same
+ * contract as seq_read_fasta_record. Sequence and quality may span several
+ * lines; the quality ends once it is as long as the sequence, since it may
+ * start with '@'. Sets *nlines, when given, to the lines of both.
+ */
+static bool seq_read_fastq_record(seq_reader *r, int64 end, StringInfo header,
+                                  dna_builder *builder, StringInfo quality,
+                                  int *nlines) {
+    int c;
+    int n = 0;
+
+    while ((c = seq_reader_peek(r)) == '\n' || c == '\r')
+        seq_reader_line(r, NULL, NULL);
+    if (c == EOF || SEQ_READER_TELL(r) >= end)
+        return false;
+    if (c != '@')
+        ereport(ERROR, (errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+                        errmsg("invalid FASTQ file \"%s\": expected '@' at %s",
+                               r->path, seq_reader_location(r))));
+
+    resetStringInfo(header);
+    seq_reader_line(r, header, NULL);
+    while ((c = seq_reader_peek(r)) != EOF && c != '+') {
+        seq_reader_line(r, NULL, builder);
+        n++;
     }
-    PG_FREE_IF_COPY(a, 0);
-    PG_FREE_IF_COPY(b, 1);
-    PG_RETURN_BOOL(result);
+    if (c == EOF)
+        ereport(ERROR, (errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+                        errmsg("invalid FASTQ file \"%s\": missing '+' line at %s",
+                               r->path, seq_reader_location(r))));
+    seq_reader_line(r, NULL, NULL);
+
+    resetStringInfo(quality);
+    do {
+        seq_reader_line(r, quality, NULL);
+        n++;
+    } while (quality->len < builder->length && seq_reader_peek(r) != EOF);
+    if (quality->len != builder->length)
+        ereport(ERROR, (errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+                        errmsg("invalid FASTQ file \"%s\": quality and sequence lengths differ in record \"%s\"",
+                               r->path, header->data + 1)));
+    if (nlines)
+        *nlines = n;
+    return true;
 }
 
-Datum
-kmer_cmp(PG_FUNCTION_ARGS) {
-    kmer *a = PG_GETARG_KMER_P(0);
-    kmer *b = PG_GETARG_KMER_P(1);
-    int result;
-    if (a->k != b->k) {
-        if (a->k > b->k) {
-            result = 1;
-        } else {
-            result = -1;
+/*
+ * Position the reader at the first record starting at or after the file
+ * offset off, so that scans of adjacent byte ranges split the file between
+ * records. Offset 0 is the start of the first record, whatever its layout. A
+ * FASTA record starts with a '>' line. In FASTQ, quality lines may also start
+ * with '@', so an '@' line only starts a record when the line after next is
+ * the '+' separator. That only holds for single-line sequence and quality, as
+ * written by sequencers: in such files a rejected '@' line is a quality line,
+ * followed by the next header, so any other line after it is an error.
+ */
+static void seq_reader_seek_record(seq_reader *r, int64 off, bool fastq) {
+    int c;
+
+    seq_reader_seek(r, off > 0 ? off - 1 : 0);
+    if (off == 0)
+        return;
+    seq_reader_line(r, NULL, NULL);
+
+    while ((c = seq_reader_peek(r)) != EOF) {
+        if (c == (fastq ? '@' : '>')) {
+            int64 start = SEQ_READER_TELL(r);
+            int next;
+
+            if (!fastq)
+                return;
+            seq_reader_line(r, NULL, NULL);
+            next = seq_reader_peek(r);
+            seq_reader_line(r, NULL, NULL);
+            c = seq_reader_peek(r);
+            seq_reader_seek(r, start);
+            if (c == '+')
+                return;
+            if (next != '@' && next != EOF && next != '\n' && next != '\r')
+                seq_fastq_multiline_error(r, psprintf("byte offset %lld", (long long) start));
         }
-    } else {
-        result = kmer_cmp_internal(a, b);
+        seq_reader_line(r, NULL, NULL);
     }
-    PG_FREE_IF_COPY(a, 0);
-    PG_FREE_IF_COPY(b, 1);
-    PG_RETURN_INT32(result);
 }
 
-// Hash function
-Datum
-kmer_hash(PG_FUNCTION_ARGS) {
-    kmer *a = PG_GETARG_KMER_P(0);
-    int32 hash;
-    hash = (int32) hash_any((unsigned char *) a->data, strlen(a->data));
-    PG_FREE_IF_COPY(a, 0);
-    PG_RETURN_INT32(hash);
+/*
+ * Split a '>' or '@' header line into the id (up to the first blank) and the
+ * description (the rest, NULL when empty)
+ */
+static void seq_header_values(StringInfo header, Datum *values, bool *nulls) {
+    char *id = header->data + 1;
+    char *desc = id + strcspn(id, " \t");
+    int idlen = desc - id;
+
+    desc += strspn(desc, " \t");
+    values[0] = PointerGetDatum(cstring_to_text_with_len(id, idlen));
+    nulls[0] = false;
+    values[1] = *desc ? PointerGetDatum(cstring_to_text(desc)) : (Datum) 0;
+    nulls[1] = *desc == '\0';
 }
-// SP-GiST functions
-Datum
-spgist_kmer_config(PG_FUNCTION_ARGS) {
-    // spgConfigIn *cfgin = (spgConfigIn *) PG_GETARG_POINTER(0);
-    spgConfigOut *cfg = (spgConfigOut *) PG_GETARG_POINTER(1);
 
-    // cfgin->attType = TEXTOID; //type of data index will store (kmer is text)
-    cfg->prefixType = TEXTOID;
-    cfg->labelType = INT2OID; // labels determine how data is partitioned
-    // cfg->leafType = TEXTOID;
-    cfg->canReturnData = true; // true so index can return data when queried
-    cfg->longValuesOK = false; 
-    PG_RETURN_VOID();
-}
+/*
+ * Stream the records of a FASTA file into (id, description, sequence) rows.
+ * The file is read in large blocks and the bases are validated and packed
+ * straight from the read buffer.
+ */
+Datum
+read_fasta(PG_FUNCTION_ARGS) {
+    char *path = text_to_cstring(PG_GETARG_TEXT_PP(0));
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+    seq_reader r;
+    dna_builder builder;
+    StringInfoData header;
+    Datum values[3];
+    bool nulls[3] = {false, false, false};
+
+    InitMaterializedSRF(fcinfo, 0);
+    seq_reader_open(&r, path);
+    dna_builder_init(&builder);
+    initStringInfo(&header);
+
+    while (seq_read_fasta_record(&r, PG_INT64_MAX, &header, &builder)) {
+        seq_header_values(&header, values, nulls);
+        values[2] = DnaPGetDatum(dna_builder_finish(&builder));
+        tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+        pfree(DatumGetPointer(values[2]));
+        CHECK_FOR_INTERRUPTS();
+    }
 
-static
-Datum formKmerDatum(char *data, int k) {
-    kmer *km = kmer_make(k, data);  /* Create kmer from data */
-    return KmerPGetDatum(km);  /* Return it as a Datum */
+    seq_reader_close(&r);
+    return (Datum) 0;
 }
 
 /*
- * Find the length of the common prefix of a and b
+ * Stream the records of a FASTQ file into (id, description, sequence,
+ * quality) rows
  */
-static int
-commonPrefix(const char *a, const char *b, int lena, int lenb)
+Datum
+read_fastq(PG_FUNCTION_ARGS) {
+    char *path = text_to_cstring(PG_GETARG_TEXT_PP(0));
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+    seq_reader r;
+    dna_builder builder;
+    StringInfoData header;
+    StringInfoData quality;
+    Datum values[4];
+    bool nulls[4] = {false, false, false, false};
+
+    InitMaterializedSRF(fcinfo, 0);
+    seq_reader_open(&r, path);
+    dna_builder_init(&builder);
+    initStringInfo(&header);
+    initStringInfo(&quality);
+
+    while (seq_read_fastq_record(&r, PG_INT64_MAX, &header, &builder, &quality, NULL)) {
+        seq_header_values(&header, values, nulls);
+        values[2] = DnaPGetDatum(dna_builder_finish(&builder));
+        values[3] = PointerGetDatum(cstring_to_text_with_len(quality.data, quality.len));
+        tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+        pfree(DatumGetPointer(values[2]));
+        CHECK_FOR_INTERRUPTS();
+    }
+
+    seq_reader_close(&r);
+    return (Datum) 0;
+}
+
+// Foreign data wrapper
+
+/* Byte range claimed at a time by the processes of a parallel scan */
+#define DNA_FDW_CHUNK_SIZE  (INT64CONST(64) * 1024 * 1024)
+
+/* Columns of a foreign table, matched by name */
+typedef enum {
+    DNA_FDW_ID,
+    DNA_FDW_DESCRIPTION,
+    DNA_FDW_SEQUENCE,
+    DNA_FDW_QUALITY,
+    DNA_FDW_KMER,
+    DNA_FDW_POSITION,
+    DNA_FDW_DROPPED
+} dna_fdw_column;
+
+typedef struct {
+    char *filename;
+    bool fastq;
+    int k;              /* k-mer length, 0 to return one row per record */
+} dna_fdw_options;
+
+/* Shared state of a parallel scan */
+typedef struct {
+    pg_atomic_uint64 next_chunk;    /* file offset of the first unclaimed chunk */
+} dna_fdw_shared;
+
+typedef struct {
+    dna_fdw_options opts;
+    dna_fdw_column *columns;
+    int64 filesize;
+    seq_reader reader;
+    dna_fdw_shared *shared;         /* NULL unless the scan is parallel */
+    int64 chunk_end;                /* end of the claimed byte range, 0 before the first */
+    MemoryContext cxt;
+    dna_builder builder;
+    StringInfoData header;
+    StringInfoData quality;
+    dna *seq;                       /* current record */
+    dna_kmer_iter it;
+} dna_fdw_state;
+
+static void
+dna_fdw_get_options(Oid foreigntableid, dna_fdw_options *opts)
 {
-    int            i = 0;
+    ForeignTable *table = GetForeignTable(foreigntableid);
+    ListCell   *lc;
+    const char *format = NULL;
 
-    while (i < lena && i < lenb && nucleotide_matches(*a, *b))
+    opts->filename = NULL;
+    opts->k = 0;
+    foreach(lc, table->options)
     {
-        a++;
-        b++;
-        i++;
+        DefElem    *def = (DefElem *) lfirst(lc);
+
+        if (strcmp(def->defname, "filename") == 0)
+            opts->filename = defGetString(def);
+        else if (strcmp(def->defname, "format") == 0)
+            format = defGetString(def);
+        else if (strcmp(def->defname, "k") == 0)
+            opts->k = pg_strtoint32(defGetString(def));
     }
+    if (opts->filename == NULL)
+        ereport(ERROR, (errcode(ERRCODE_FDW_OPTION_NAME_NOT_FOUND),
+                        errmsg("filename is required for dnasequence_fdw foreign tables")));
+
+    /* Without an explicit format, files named *.fq or *.fastq are FASTQ */
+    if (format == NULL)
+    {
+        const char *ext = strrchr(opts->filename, '.');
 
-    return i;
+        opts->fastq = ext != NULL && (pg_strcasecmp(ext, ".fq") == 0 ||
+                                      pg_strcasecmp(ext, ".fastq") == 0);
+    }
+    else
+        opts->fastq = pg_strcasecmp(format, "fastq") == 0;
 }
 
 /*
- * Binary search an array of int16 datums for a match to c
- *
- * On success, *i gets the match location; on failure, it gets where to insert
+ * Validate the options of a dnasequence_fdw object. Only foreign tables take
+ * options: filename, format (fasta or fastq) and k, which turns every record
+ * into one row per k-mer.
  */
-static bool
-searchChar(Datum *nodeLabels, int nNodes, int16 c, int *i)
+Datum
+dnasequence_fdw_validator(PG_FUNCTION_ARGS)
 {
-    int            StopLow = 0,
-                StopHigh = nNodes;
+    List       *options = untransformRelOptions(PG_GETARG_DATUM(0));
+    Oid         catalog = PG_GETARG_OID(1);
+    bool        has_filename = false;
+    ListCell   *lc;
 
-    while (StopLow < StopHigh)
+    foreach(lc, options)
     {
-        int            StopMiddle = (StopLow + StopHigh) >> 1;
-        int16        middle = DatumGetInt16(nodeLabels[StopMiddle]);
+        DefElem    *def = (DefElem *) lfirst(lc);
 
-        if (c < middle)
-            StopHigh = StopMiddle;
-        else if (c > middle)
-            StopLow = StopMiddle + 1;
+        if (catalog != ForeignTableRelationId ||
+            (strcmp(def->defname, "filename") != 0 &&
+             strcmp(def->defname, "format") != 0 &&
+             strcmp(def->defname, "k") != 0))
+            ereport(ERROR, (errcode(ERRCODE_FDW_INVALID_OPTION_NAME),
+                            errmsg("invalid option \"%s\"", def->defname),
+                            errhint("Foreign tables of dnasequence_fdw accept the options filename, format and k.")));
+
+        if (strcmp(def->defname, "filename") == 0)
+        {
+            /* Reading server files is reserved as for read_fasta */
+            if (!has_privs_of_role(GetUserId(), ROLE_PG_READ_SERVER_FILES))
+                ereport(ERROR, (errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+                                errmsg("only superuser or a role with privileges of the pg_read_server_files role may specify the filename option of a dnasequence_fdw foreign table")));
+            has_filename = true;
+        }
+        else if (strcmp(def->defname, "format") == 0)
+        {
+            const char *format = defGetString(def);
+
+            if (pg_strcasecmp(format, "fasta") != 0 && pg_strcasecmp(format, "fastq") != 0)
+                ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                                errmsg("format must be \"fasta\" or \"fastq\"")));
+        }
         else
         {
-            *i = StopMiddle;
-            return true;
+            int         k = pg_strtoint32(defGetString(def));
+
+            if (k <= 0 || k > MAX_KMER_LEN)
+                ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                                errmsg("k must be between 1 and %d", MAX_KMER_LEN)));
         }
     }
 
-    *i = StopHigh;
-    return false;
+    if (catalog == ForeignTableRelationId && !has_filename)
+        ereport(ERROR, (errcode(ERRCODE_FDW_OPTION_NAME_NOT_FOUND),
+                        errmsg("filename is required for dnasequence_fdw foreign tables")));
+    PG_RETURN_VOID();
 }
 
-Datum
-spgist_kmer_choose(PG_FUNCTION_ARGS) {
-    spgChooseIn *in = (spgChooseIn *) PG_GETARG_POINTER(0);
-    spgChooseOut *out = (spgChooseOut *) PG_GETARG_POINTER(1);
+static int64
+dna_fdw_file_size(const char *filename)
+{
+    struct stat st;
 
-    kmer    *inKmer = DatumGetKmerP(in->datum);
-    char    *inData = inKmer->data;
-    int      inK = inKmer->k;
-    char    *prefixData = NULL;
-    int      prefixK = 0;
-    int      commonLen = 0;
-    int16    nodeChar = 0;
-    int      i = 0;
+    if (stat(filename, &st) < 0)
+        return -1;
+    return st.st_size;
+}
 
-    /* Check for prefix match, set nodeChar to first byte after prefix */
-    if (in->hasPrefix)
-    {
-        kmer *prefixKmer = DatumGetKmerP(in->prefixDatum);
+/*
+ * Estimate the rows from the file size: FASTQ reads are a few hundred bytes,
+ * FASTA records typically much longer, and in k-mer mode there is about one
+ * row per byte
+ */
+static void
+dnasequenceGetForeignRelSize(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntableid)
+{
+    dna_fdw_options *opts = palloc(sizeof(dna_fdw_options));
+    int64       size;
 
-        prefixData = prefixKmer->data;
-        prefixK = prefixKmer->k;
+    dna_fdw_get_options(foreigntableid, opts);
+    size = dna_fdw_file_size(opts->filename);
+    if (size < 0)
+        size = 10 * BLCKSZ;
 
-        commonLen = commonPrefix(inData + in->level,
-                                 prefixData,
-                                 inK - in->level,
-                                 prefixK);
+    baserel->pages = Max(1, (size + BLCKSZ - 1) / BLCKSZ);
+    if (opts->k > 0)
+        baserel->tuples = size;
+    else
+        baserel->tuples = size / (opts->fastq ? 250 : 10000);
+    baserel->tuples = Max(baserel->tuples, 1);
+    baserel->rows = clamp_row_est(baserel->tuples *
+                                  clauselist_selectivity(root, baserel->baserestrictinfo,
+                                                         0, JOIN_INNER, NULL));
+    baserel->fdw_private = opts;
+}
 
-        if (commonLen == prefixK)
-        {
-            /* node label --- first non-common character */
-            if (inK - in->level > commonLen)
-                nodeChar = *(unsigned char *) (inData + in->level + commonLen);
-            else
-                nodeChar = -1; /* completely common values */
-        }
-        else /* Not match prefix  -> split tuple */
-        {
+/* Leading records of a FASTQ file checked before planning a parallel scan */
+#define DNA_FDW_FASTQ_PROBE_RECORDS 8
+
+/*
+ * Whether the first records of a FASTQ file have single-line sequence and
+ * quality, as the parallel scan needs to find record starts
+ */
+static bool
+dna_fdw_fastq_single_line(const char *filename)
+{
+    seq_reader  r;
+    dna_builder builder;
+    StringInfoData header;
+    StringInfoData quality;
+    int         nlines;
+    bool        result = true;
+
+    seq_reader_open(&r, filename);
+    dna_builder_init(&builder);
+    initStringInfo(&header);
+    initStringInfo(&quality);
+    for (int i = 0; i < DNA_FDW_FASTQ_PROBE_RECORDS && result; i++)
+    {
+        if (!seq_read_fastq_record(&r, PG_INT64_MAX, &header, &builder, &quality, &nlines))
+            break;
+        pfree(dna_builder_finish(&builder));
+        result = nlines <= 2;
+    }
+    seq_reader_close(&r);
+    pfree(builder.bases);
+    pfree(builder.exceptions);
+    pfree(header.data);
+    pfree(quality.data);
+    return result;
+}
+
+/*
+ * Offer a plain scan and, when the relation may be scanned in parallel, a
+ * partial scan whose processes split the file between them. FASTQ files with
+ * multi-line records only get the plain scan.
+ */
+static void
+dnasequenceGetForeignPaths(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntableid)
+{
+    dna_fdw_options *opts = (dna_fdw_options *) baserel->fdw_private;
+    Cost        run_cost = seq_page_cost * baserel->pages +
+                           cpu_tuple_cost * baserel->tuples;
+
+    add_path(baserel, (Path *)
+             create_foreignscan_path(root, baserel, NULL, baserel->rows,
+                                     0, run_cost, NIL, NULL, NULL, NIL));
+
+    if (baserel->consider_parallel)
+    {
+        int         workers = compute_parallel_worker(baserel, baserel->pages, -1,
+                                                      max_parallel_workers_per_gather);
+        ForeignPath *path;
+
+        if (workers <= 0)
+            return;
+        if (opts->fastq && (dna_fdw_file_size(opts->filename) < 0 ||
+                            !dna_fdw_fastq_single_line(opts->filename)))
+            return;
+        path = create_foreignscan_path(root, baserel, NULL,
+                                       clamp_row_est(baserel->rows / (workers + 1)),
+                                       0, run_cost / (workers + 1), NIL, NULL, NULL, NIL);
+        path->path.parallel_aware = true;
+        path->path.parallel_safe = true;
+        path->path.parallel_workers = workers;
+        add_partial_path(baserel, (Path *) path);
+    }
+}
+
+static ForeignScan *
+dnasequenceGetForeignPlan(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntableid,
+                          ForeignPath *best_path, List *tlist, List *scan_clauses,
+                          Plan *outer_plan)
+{
+    scan_clauses = extract_actual_clauses(scan_clauses, false);
+    return make_foreignscan(tlist, scan_clauses, baserel->relid,
+                            NIL, NIL, NIL, NIL, outer_plan);
+}
+
+static void
+dnasequenceExplainForeignScan(ForeignScanState *node, ExplainState *es)
+{
+    dna_fdw_options opts;
+
+    dna_fdw_get_options(RelationGetRelid(node->ss.ss_currentRelation), &opts);
+    ExplainPropertyText("Foreign File", opts.filename, es);
+    ExplainPropertyText("Format", opts.fastq ? "FASTQ" : "FASTA", es);
+    if (opts.k > 0)
+        ExplainPropertyInteger("K-mer Length", NULL, opts.k, es);
+}
+
+/* Whether a column type is ours, recognized by its input function */
+static bool
+dna_fdw_type_is(Oid typid, PGFunction input)
+{
+    Oid         typinput;
+    Oid         typioparam;
+    FmgrInfo    finfo;
+
+    getTypeInputInfo(typid, &typinput, &typioparam);
+    fmgr_info(typinput, &finfo);
+    return finfo.fn_addr == input;
+}
+
+/*
+ * Map every column of the foreign table to a record field by name: id,
+ * description, sequence and quality (text, text, dna, text), and in k-mer mode
+ * kmer and position (kmer, integer)
+ */
+static dna_fdw_column *
+dna_fdw_map_columns(TupleDesc tupdesc, const dna_fdw_options *opts)
+{
+    static const char *const names[] = {"id", "description", "sequence", "quality", "kmer", "position"};
+    dna_fdw_column *columns = palloc(tupdesc->natts * sizeof(dna_fdw_column));
+
+    for (int i = 0; i < tupdesc->natts; i++)
+    {
+        Form_pg_attribute attr = TupleDescAttr(tupdesc, i);
+        const char *name = NameStr(attr->attname);
+        bool        typeok;
+        int         c;
+
+        if (attr->attisdropped)
+        {
+            columns[i] = DNA_FDW_DROPPED;
+            continue;
+        }
+        for (c = 0; c < lengthof(names); c++)
+            if (strcmp(name, names[c]) == 0)
+                break;
+        if (c == lengthof(names) || (c >= DNA_FDW_KMER && opts->k == 0))
+            ereport(ERROR, (errcode(ERRCODE_FDW_INVALID_COLUMN_NAME),
+                            errmsg("column \"%s\" does not match a field of %s records", name,
+                                   opts->fastq ? "FASTQ" : "FASTA"),
+                            errhint("Valid columns are id, description, sequence and quality, plus kmer and position when the k option is set.")));
+
+        switch ((dna_fdw_column) c)
+        {
+            case DNA_FDW_SEQUENCE:
+                typeok = dna_fdw_type_is(attr->atttypid, dna_in);
+                break;
+            case DNA_FDW_KMER:
+                typeok = dna_fdw_type_is(attr->atttypid, kmer_in);
+                break;
+            case DNA_FDW_POSITION:
+                typeok = attr->atttypid == INT4OID;
+                break;
+            default:
+                typeok = attr->atttypid == TEXTOID;
+                break;
+        }
+        if (!typeok)
+            ereport(ERROR, (errcode(ERRCODE_FDW_INVALID_DATA_TYPE),
+                            errmsg("column \"%s\" has type %s, which does not match the record field",
+                                   name, format_type_be(attr->atttypid))));
+        columns[i] = (dna_fdw_column) c;
+    }
+    return columns;
+}
+
+static void
+dnasequenceBeginForeignScan(ForeignScanState *node, int eflags)
+{
+    Relation    rel = node->ss.ss_currentRelation;
+    dna_fdw_state *state;
+
+    if (eflags & EXEC_FLAG_EXPLAIN_ONLY)
+        return;
+
+    state = palloc0(sizeof(dna_fdw_state));
+    dna_fdw_get_options(RelationGetRelid(rel), &state->opts);
+    state->columns = dna_fdw_map_columns(RelationGetDescr(rel), &state->opts);
+    state->filesize = dna_fdw_file_size(state->opts.filename);
+    seq_reader_open(&state->reader, state->opts.filename);
+    state->cxt = CurrentMemoryContext;
+    dna_builder_init(&state->builder);
+    initStringInfo(&state->header);
+    initStringInfo(&state->quality);
+    node->fdw_state = state;
+}
+
+/*
+ * Claim the next byte range to scan and move to its first record. A serial
+ * scan reads the whole file as one range; the processes of a parallel scan
+ * claim fixed-size chunks in turn, each reading the records that start in it.
+ */
+static bool
+dna_fdw_next_chunk(dna_fdw_state *state)
+{
+    uint64      start;
+
+    if (state->shared == NULL)
+    {
+        if (state->chunk_end == PG_INT64_MAX)
+            return false;
+        start = 0;
+        state->chunk_end = PG_INT64_MAX;
+    }
+    else
+    {
+        start = pg_atomic_fetch_add_u64(&state->shared->next_chunk, DNA_FDW_CHUNK_SIZE);
+        if (start >= (uint64) state->filesize)
+            return false;
+        state->chunk_end = start + DNA_FDW_CHUNK_SIZE;
+    }
+    seq_reader_seek_record(&state->reader, start, state->opts.fastq);
+    return true;
+}
+
+/*
+ * Read the next record of the scan. In k-mer mode the sequence outlives the
+ * per-tuple memory, so it is kept in the scan context until the next record.
+ */
+static bool
+dna_fdw_next_record(dna_fdw_state *state)
+{
+    MemoryContext oldcxt;
+
+    for (;;)
+    {
+        bool        found;
+        int         nlines;
+
+        if (state->chunk_end == 0)
+            found = false;
+        else if (state->opts.fastq)
+        {
+            found = seq_read_fastq_record(&state->reader, state->chunk_end, &state->header,
+                                          &state->builder, &state->quality, &nlines);
+            if (found && nlines > 2 && state->shared != NULL)
+                seq_fastq_multiline_error(&state->reader,
+                                          psprintf("record \"%s\"", state->header.data + 1));
+        }
+        else
+            found = seq_read_fasta_record(&state->reader, state->chunk_end, &state->header,
+                                          &state->builder);
+        if (found)
+            break;
+        if (!dna_fdw_next_chunk(state))
+            return false;
+    }
+
+    if (state->opts.k > 0)
+    {
+        if (state->seq != NULL)
+            pfree(state->seq);
+        oldcxt = MemoryContextSwitchTo(state->cxt);
+        state->seq = dna_builder_finish(&state->builder);
+        MemoryContextSwitchTo(oldcxt);
+        dna_kmer_iter_init(&state->it, state->seq, state->opts.k, false);
+    }
+    else
+        state->seq = dna_builder_finish(&state->builder);
+    return true;
+}
+
+/*
+ * Return the next record, or in k-mer mode the next k-mer of the current
+ * record, as generate_kmers would produce it
+ */
+static TupleTableSlot *
+dnasequenceIterateForeignScan(ForeignScanState *node)
+{
+    dna_fdw_state *state = (dna_fdw_state *) node->fdw_state;
+    TupleTableSlot *slot = node->ss.ss_ScanTupleSlot;
+    Datum       header[2];
+    bool        header_nulls[2];
+    uint64      code = 0;
+    int         start = 0;
+
+    ExecClearTuple(slot);
+    if (state->opts.k > 0)
+    {
+        while (state->seq == NULL || !dna_kmer_iter_next(&state->it, &code, &start))
+        {
+            if (!dna_fdw_next_record(state))
+                return slot;
+            CHECK_FOR_INTERRUPTS();
+        }
+    }
+    else if (!dna_fdw_next_record(state))
+        return slot;
+
+    seq_header_values(&state->header, header, header_nulls);
+    for (int i = 0; i < slot->tts_tupleDescriptor->natts; i++)
+    {
+        slot->tts_isnull[i] = false;
+        switch (state->columns[i])
+        {
+            case DNA_FDW_ID:
+            case DNA_FDW_DESCRIPTION:
+                slot->tts_values[i] = header[state->columns[i]];
+                slot->tts_isnull[i] = header_nulls[state->columns[i]];
+                break;
+            case DNA_FDW_SEQUENCE:
+                slot->tts_values[i] = DnaPGetDatum(state->seq);
+                break;
+            case DNA_FDW_QUALITY:
+                if (state->opts.fastq)
+                    slot->tts_values[i] = PointerGetDatum(
+                        cstring_to_text_with_len(state->quality.data, state->quality.len));
+                else
+                    slot->tts_isnull[i] = true;
+                break;
+            case DNA_FDW_KMER:
+                slot->tts_values[i] = KmerPGetDatum(kmer_from_code(state->opts.k, code));
+                break;
+            case DNA_FDW_POSITION:
+                slot->tts_values[i] = Int32GetDatum(start + 1);
+                break;
+            case DNA_FDW_DROPPED:
+                slot->tts_isnull[i] = true;
+                break;
+        }
+    }
+    return ExecStoreVirtualTuple(slot);
+}
+
+static void
+dnasequenceReScanForeignScan(ForeignScanState *node)
+{
+    dna_fdw_state *state = (dna_fdw_state *) node->fdw_state;
+
+    if (state->opts.k > 0 && state->seq != NULL)
+        pfree(state->seq);
+    state->seq = NULL;
+    state->chunk_end = 0;
+}
+
+static void
+dnasequenceEndForeignScan(ForeignScanState *node)
+{
+    dna_fdw_state *state = (dna_fdw_state *) node->fdw_state;
+
+    if (state != NULL)
+        seq_reader_close(&state->reader);
+}
+
+static bool
+dnasequenceIsForeignScanParallelSafe(PlannerInfo *root, RelOptInfo *rel, RangeTblEntry *rte)
+{
+    return true;
+}
+
+static Size
+dnasequenceEstimateDSMForeignScan(ForeignScanState *node, ParallelContext *pcxt)
+{
+    return sizeof(dna_fdw_shared);
+}
+
+static void
+dnasequenceInitializeDSMForeignScan(ForeignScanState *node, ParallelContext *pcxt,
+                                    void *coordinate)
+{
+    dna_fdw_state *state = (dna_fdw_state *) node->fdw_state;
+
+    state->shared = (dna_fdw_shared *) coordinate;
+    pg_atomic_init_u64(&state->shared->next_chunk, 0);
+}
+
+static void
+dnasequenceReInitializeDSMForeignScan(ForeignScanState *node, ParallelContext *pcxt,
+                                      void *coordinate)
+{
+    pg_atomic_write_u64(&((dna_fdw_shared *) coordinate)->next_chunk, 0);
+}
+
+static void
+dnasequenceInitializeWorkerForeignScan(ForeignScanState *node, shm_toc *toc,
+                                       void *coordinate)
+{
+    dna_fdw_state *state = (dna_fdw_state *) node->fdw_state;
+
+    state->shared = (dna_fdw_shared *) coordinate;
+}
+
+Datum
+dnasequence_fdw_handler(PG_FUNCTION_ARGS)
+{
+    FdwRoutine *routine = makeNode(FdwRoutine);
+
+    routine->GetForeignRelSize = dnasequenceGetForeignRelSize;
+    routine->GetForeignPaths = dnasequenceGetForeignPaths;
+    routine->GetForeignPlan = dnasequenceGetForeignPlan;
+    routine->ExplainForeignScan = dnasequenceExplainForeignScan;
+    routine->BeginForeignScan = dnasequenceBeginForeignScan;
+    routine->IterateForeignScan = dnasequenceIterateForeignScan;
+    routine->ReScanForeignScan = dnasequenceReScanForeignScan;
+    routine->EndForeignScan = dnasequenceEndForeignScan;
+    routine->IsForeignScanParallelSafe = dnasequenceIsForeignScanParallelSafe;
+    routine->EstimateDSMForeignScan = dnasequenceEstimateDSMForeignScan;
+    routine->InitializeDSMForeignScan = dnasequenceInitializeDSMForeignScan;
+    routine->ReInitializeDSMForeignScan = dnasequenceReInitializeDSMForeignScan;
+    routine->InitializeWorkerForeignScan = dnasequenceInitializeWorkerForeignScan;
+    PG_RETURN_POINTER(routine);
+}
+
+// ********** kmer **********
+Datum
+kmer_in(PG_FUNCTION_ARGS) {
+    char *str = PG_GETARG_CSTRING(0);
+    if (str == NULL || strlen(str) == 0) {
+        ereport(ERROR,
+                (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+                 errmsg("Input to kmer type cannot be NULL or empty")));
+    }
+    PG_RETURN_KMER_P(kmer_parse(str));
+}
+
+Datum
+kmer_out(PG_FUNCTION_ARGS) {
+    kmer *c = PG_GETARG_KMER_P(0);
+    PG_RETURN_CSTRING(kmer_to_str(c));
+}
+
+/*
+ * Binary format: the length (byte) followed by the bytes of the code that hold
+ * bases, 4 bases per byte as in dna
+ */
+Datum
+kmer_recv(PG_FUNCTION_ARGS) {
+    StringInfo buf = (StringInfo) PG_GETARG_POINTER(0);
+    int k = pq_getmsgbyte(buf);
+    uint64 code = 0;
+
+    if (k > MAX_KMER_LEN)
+        ereport(ERROR, (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+                        errmsg("invalid external kmer value")));
+    for (int i = 0; i < DNA_PACKED_SIZE(k); i++)
+        code |= (uint64) pq_getmsgbyte(buf) << (56 - 8 * i);
+    if ((code & ~KMER_MASK(k)) != 0)
+        ereport(ERROR, (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+                        errmsg("invalid external kmer value")));
+    PG_RETURN_KMER_P(kmer_from_code(k, code));
+}
+
+Datum
+kmer_send(PG_FUNCTION_ARGS) {
+    kmer *c = PG_GETARG_KMER_P(0);
+    StringInfoData buf;
+
+    pq_begintypsend(&buf);
+    pq_sendbyte(&buf, c->k);
+    for (int i = 0; i < DNA_PACKED_SIZE(c->k); i++)
+        pq_sendbyte(&buf, (uint8) (c->code >> (56 - 8 * i)));
+    PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
+}
+
+Datum
+kmer_cast_from_text(PG_FUNCTION_ARGS) {
+    text *txt = PG_GETARG_TEXT_P(0);
+    char *str = DatumGetCString(DirectFunctionCall1(textout, PointerGetDatum(txt)));
+    PG_RETURN_KMER_P(kmer_parse(str));
+}
+
+Datum
+kmer_cast_to_text(PG_FUNCTION_ARGS) {
+    kmer *c = PG_GETARG_KMER_P(0);
+    PG_RETURN_TEXT_P(cstring_to_text(kmer_to_str(c)));
+}
+
+// Ref: https://doxygen.postgresql.org/varlena_8c.html#a7777d194920e57222a17b02166fc7232
+Datum
+kmer_constructor(PG_FUNCTION_ARGS) {
+    int k = PG_GETARG_INT32(0);
+    char *data = text_to_cstring(PG_GETARG_TEXT_PP(1));
+    if (k < 0 || k > MAX_KMER_LEN || k > (int) strlen(data))
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE), errmsg("Invalid k value: must be between 0 and min(text length, %d)", MAX_KMER_LEN)));
+    PG_RETURN_KMER_P(kmer_make(k, data));
+}
+
+Datum
+kmer_length(PG_FUNCTION_ARGS) {
+    kmer *c = PG_GETARG_KMER_P(0);
+    int k = c->k;
+    PG_FREE_IF_COPY(c, 0);
+    PG_RETURN_INT32(k);
+}
+
+Datum
+kmer_reverse_complement(PG_FUNCTION_ARGS) {
+    kmer *c = PG_GETARG_KMER_P(0);
+    PG_RETURN_KMER_P(kmer_from_code(c->k, kmer_revcomp_code(c->code, c->k)));
+}
+
+/*
+ * The smaller of a kmer and its reverse complement, the same for both strands
+ */
+Datum
+kmer_canonical(PG_FUNCTION_ARGS) {
+    kmer *c = PG_GETARG_KMER_P(0);
+    PG_RETURN_KMER_P(kmer_from_code(c->k, Min(c->code, kmer_revcomp_code(c->code, c->k))));
+}
+
+Datum
+kmer_equals(PG_FUNCTION_ARGS) {
+    kmer *a = PG_GETARG_KMER_P(0);
+    kmer *b = PG_GETARG_KMER_P(1);
+    PG_RETURN_BOOL(a->k == b->k && a->code == b->code);
+}
+
+Datum
+kmer_starts_with(PG_FUNCTION_ARGS) {
+    kmer *prefix = PG_GETARG_KMER_P(0);
+    kmer *c = PG_GETARG_KMER_P(1);
+    PG_RETURN_BOOL(starts_with(prefix, c));
+}
+
+Datum
+kmer_starts_with_swapped(PG_FUNCTION_ARGS) {
+    kmer *c = PG_GETARG_KMER_P(0);
+    kmer *prefix = PG_GETARG_KMER_P(1);
+    PG_RETURN_BOOL(starts_with(prefix, c));
+}
+
+/*
+ * Build "leftop op value" with the member of opfamily for strategy
+ */
+static Expr *
+kmer_index_clause(Oid opfamily, int strategy, Node *leftop, kmer *value)
+{
+    Oid         kmertype = exprType(leftop);
+    Oid         opno = get_opfamily_member(opfamily, kmertype, kmertype, strategy);
+    Expr       *clause;
+
+    if (!OidIsValid(opno))
+        return NULL;
+    clause = make_opclause(opno, BOOLOID, false, (Expr *) leftop,
+                           (Expr *) makeConst(kmertype, -1, InvalidOid, sizeof(kmer),
+                                              KmerPGetDatum(value), false, false),
+                           InvalidOid, InvalidOid);
+    set_opfuncid((OpExpr *) clause);
+    return clause;
+}
+
+/*
+ * Answer a SupportRequestIndexCondition for a prefix test with a constant
+ * prefix (argument prefixArg). On a btree index it becomes the range
+ * c >= P AND c <= P·TTT...; kmers sort lexicographically, so the range holds
+ * exactly the kmers starting with P. On an SP-GiST index it becomes ^@.
+ */
+static List *
+kmer_prefix_index_condition(Node *rawreq, int prefixArg)
+{
+    SupportRequestIndexCondition *req;
+    List       *args;
+    Node       *leftop,
+               *rightop;
+    kmer       *prefix;
+    Oid         amoid;
+    Expr       *lower,
+               *upper;
+
+    if (!IsA(rawreq, SupportRequestIndexCondition))
+        return NIL;
+    req = (SupportRequestIndexCondition *) rawreq;
+
+    if (is_opclause(req->node))
+        args = ((OpExpr *) req->node)->args;
+    else if (is_funcclause(req->node))
+        args = ((FuncExpr *) req->node)->args;
+    else
+        return NIL;
+    if (list_length(args) != 2 || req->indexarg != 1 - prefixArg)
+        return NIL;
+
+    leftop = (Node *) list_nth(args, req->indexarg);
+    rightop = (Node *) list_nth(args, prefixArg);
+    if (!IsA(rightop, Const) || ((Const *) rightop)->constisnull)
+        return NIL;
+    prefix = DatumGetKmerP(((Const *) rightop)->constvalue);
+
+    amoid = get_opfamily_method(req->opfamily);
+    if (amoid == BTREE_AM_OID)
+    {
+        lower = kmer_index_clause(req->opfamily, BTGreaterEqualStrategyNumber, leftop,
+                                  kmer_from_code(prefix->k, prefix->code));
+        upper = kmer_index_clause(req->opfamily, BTLessEqualStrategyNumber, leftop,
+                                  kmer_from_code(MAX_KMER_LEN, prefix->code | ~KMER_MASK(prefix->k)));
+        if (lower == NULL || upper == NULL)
+            return NIL;
+        req->lossy = false;
+        return list_make2(lower, upper);
+    }
+    if (amoid == SPGIST_AM_OID && !is_opclause(req->node))
+    {
+        lower = kmer_index_clause(req->opfamily, StartsWithStrategyNumber, leftop,
+                                  kmer_from_code(prefix->k, prefix->code));
+        if (lower == NULL)
+            return NIL;
+        req->lossy = false;
+        return list_make1(lower);
+    }
+    return NIL;
+}
+
+/* Planner support for starts_with(prefix, kmer) */
+Datum
+kmer_starts_with_support(PG_FUNCTION_ARGS)
+{
+    PG_RETURN_POINTER(kmer_prefix_index_condition((Node *) PG_GETARG_POINTER(0), 0));
+}
+
+/* Planner support for kmer ^@ prefix */
+Datum
+kmer_starts_with_swapped_support(PG_FUNCTION_ARGS)
+{
+    PG_RETURN_POINTER(kmer_prefix_index_condition((Node *) PG_GETARG_POINTER(0), 1));
+}
+
+Datum
+kmer_distance(PG_FUNCTION_ARGS) {
+    kmer *a = PG_GETARG_KMER_P(0);
+    kmer *b = PG_GETARG_KMER_P(1);
+    PG_RETURN_FLOAT8((float8) kmer_hamming_internal(a, b));
+}
+
+Datum
+kmer_similar(PG_FUNCTION_ARGS) {
+    kmer *a = PG_GETARG_KMER_P(0);
+    kmer *b = PG_GETARG_KMER_P(1);
+    PG_RETURN_BOOL(kmer_hamming_internal(a, b) <= hamming_threshold);
+}
+
+/*
+ * Materialize all k-mers of the sequence into a tuplestore. The sequence is
+ * detoasted once and every k-mer is produced by the rolling iterator.
+ */
+Datum
+generate_kmers(PG_FUNCTION_ARGS) {    
+    dna *dna_sequence = PG_GETARG_DNA_P(0);
+    int k = PG_GETARG_INT32(1);
+    bool canonical = PG_GETARG_BOOL(2);
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+    dna_kmer_iter it;
+    kmer result_kmer;
+    uint64 code;
+    int start;
+    Datum values[1];
+    bool nulls[1] = {false};
+
+    if (k <= 0 || k > dna_sequence->length || k > MAX_KMER_LEN) {
+        ereport(ERROR, (errmsg("Invalid k value: must be between 1 and min(sequence length, %d)", MAX_KMER_LEN)));
+    }
+
+    InitMaterializedSRF(fcinfo, MAT_SRF_USE_EXPECTED_DESC);
+
+    memset(&result_kmer, 0, sizeof(kmer));
+    result_kmer.k = k;
+    values[0] = KmerPGetDatum(&result_kmer);
+
+    dna_kmer_iter_init(&it, dna_sequence, k, canonical);
+    while (dna_kmer_iter_next(&it, &code, &start)) {
+        result_kmer.code = code;
+        tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+    }
+
+    PG_FREE_IF_COPY(dna_sequence, 0);
+    return (Datum) 0;
+}
+
+/*
+ * Materialize the minimizers of the sequence: for every window of w
+ * consecutive k-mers, the one of smallest hash, each reported once with its
+ * 1-based position
+ */
+Datum
+generate_minimizers(PG_FUNCTION_ARGS) {
+    dna *dna_sequence = PG_GETARG_DNA_P(0);
+    int k = PG_GETARG_INT32(1);
+    int w = PG_GETARG_INT32(2);
+    bool canonical = PG_GETARG_BOOL(3);
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+    kmer_minimizer_iter it;
+    kmer result_kmer;
+    uint64 code;
+    int start;
+    Datum values[2];
+    bool nulls[2] = {false, false};
+
+    if (k <= 0 || k > dna_sequence->length || k > MAX_KMER_LEN) {
+        ereport(ERROR, (errmsg("Invalid k value: must be between 1 and min(sequence length, %d)", MAX_KMER_LEN)));
+    }
+    if (w <= 0)
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("Invalid window size: must be at least 1")));
+
+    InitMaterializedSRF(fcinfo, 0);
+
+    memset(&result_kmer, 0, sizeof(kmer));
+    result_kmer.k = k;
+    values[1] = KmerPGetDatum(&result_kmer);
+
+    kmer_minimizer_iter_init(&it, dna_sequence, k, w, canonical);
+    while (kmer_minimizer_iter_next(&it, &code, &start)) {
+        values[0] = Int32GetDatum(start + 1);
+        result_kmer.code = code;
+        tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+    }
+
+    pfree(it.deque.entries);
+    PG_FREE_IF_COPY(dna_sequence, 0);
+    return (Datum) 0;
+}
+
+/*
+ * Materialize the closed syncmers of the sequence: the k-mers whose smallest
+ * s-mer is at their start or end, with their 1-based position. Unlike
+ * minimizers, whether a k-mer is selected depends on the k-mer alone.
+ */
+Datum
+generate_syncmers(PG_FUNCTION_ARGS) {
+    dna *dna_sequence = PG_GETARG_DNA_P(0);
+    int k = PG_GETARG_INT32(1);
+    int s = PG_GETARG_INT32(2);
+    bool canonical = PG_GETARG_BOOL(3);
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+    kmer_syncmer_iter it;
+    kmer result_kmer;
+    uint64 code;
+    int start;
+    Datum values[2];
+    bool nulls[2] = {false, false};
+
+    if (k <= 0 || k > dna_sequence->length || k > MAX_KMER_LEN) {
+        ereport(ERROR, (errmsg("Invalid k value: must be between 1 and min(sequence length, %d)", MAX_KMER_LEN)));
+    }
+    if (s <= 0 || s > k)
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("Invalid s value: must be between 1 and k (%d)", k)));
+
+    InitMaterializedSRF(fcinfo, 0);
+
+    memset(&result_kmer, 0, sizeof(kmer));
+    result_kmer.k = k;
+    values[1] = KmerPGetDatum(&result_kmer);
+
+    kmer_syncmer_iter_init(&it, dna_sequence, k, s, canonical);
+    while (kmer_syncmer_iter_next(&it, &code, &start)) {
+        values[0] = Int32GetDatum(start + 1);
+        result_kmer.code = code;
+        tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+    }
+
+    pfree(it.deque.entries);
+    PG_FREE_IF_COPY(dna_sequence, 0);
+    return (Datum) 0;
+}
+
+/*
+ * Estimate the number of bases of a dna expression: exact for a constant,
+ * otherwise the average from the column statistics, falling back to the
+ * average width. Returns -1 when nothing is known.
+ */
+static double
+dna_estimate_length(PlannerInfo *root, Node *node)
+{
+    VariableStatData vardata;
+    AttStatsSlot sslot;
+    double      length = -1;
+
+    if (IsA(node, Const))
+    {
+        if (((Const *) node)->constisnull)
+            return 0;
+        return DatumGetDnaP(((Const *) node)->constvalue)->length;
+    }
+    if (root == NULL)
+        return -1;
+
+    examine_variable(root, node, 0, &vardata);
+    if (HeapTupleIsValid(vardata.statsTuple))
+    {
+        if (get_attstatsslot(&sslot, vardata.statsTuple, STATISTIC_KIND_DNA_LENGTH,
+                             InvalidOid, ATTSTATSSLOT_NUMBERS))
+        {
+            if (sslot.nnumbers == 1)
+                length = sslot.numbers[0];
+            free_attstatsslot(&sslot);
+        }
+        if (length < 0)
+        {
+            int32       width = ((Form_pg_statistic) GETSTRUCT(vardata.statsTuple))->stawidth;
+
+            if (width > DNA_HDRSZ)
+                length = 4.0 * (width - DNA_HDRSZ);
+        }
+    }
+    ReleaseVariableStats(vardata);
+    return length;
+}
+
+/*
+ * Answer a SupportRequestRows for f(dna, k): a sequence of n bases has
+ * n - k + 1 k-mers, and at most 4^k of them are distinct
+ */
+static Node *
+kmer_rows_support(Node *rawreq, bool distinct)
+{
+    SupportRequestRows *req;
+    FuncExpr   *func;
+    Node       *arg1,
+               *arg2;
+    double      length,
+                rows;
+    int         k;
+
+    if (!IsA(rawreq, SupportRequestRows))
+        return NULL;
+    req = (SupportRequestRows *) rawreq;
+    if (!is_funcclause(req->node))  /* be paranoid */
+        return NULL;
+
+    func = (FuncExpr *) req->node;
+    arg1 = estimate_expression_value(req->root, linitial(func->args));
+    arg2 = estimate_expression_value(req->root, lsecond(func->args));
+    if (!IsA(arg2, Const) || ((Const *) arg2)->constisnull)
+        return NULL;
+    length = dna_estimate_length(req->root, arg1);
+    if (length < 0)
+        return NULL;
+
+    k = DatumGetInt32(((Const *) arg2)->constvalue);
+    rows = Max(length - k + 1, 1);
+    if (distinct && k > 0 && k < MAX_KMER_LEN)
+        rows = Min(rows, ldexp(1.0, 2 * k));
+    req->rows = rows;
+    return (Node *) req;
+}
+
+Datum
+generate_kmers_support(PG_FUNCTION_ARGS)
+{
+    PG_RETURN_POINTER(kmer_rows_support((Node *) PG_GETARG_POINTER(0), false));
+}
+
+Datum
+kmer_count_support(PG_FUNCTION_ARGS)
+{
+    PG_RETURN_POINTER(kmer_rows_support((Node *) PG_GETARG_POINTER(0), true));
+}
+
+/*
+ * k-mers that did not fit in the table of a kmer_count pass, split by hash
+ * into temporary files as in the hash aggregate spill. Each level partitions
+ * on the high hash bits below those of the levels above it, so a partition
+ * that overflows again splits into smaller ones.
+ */
+typedef struct {
+    int used_bits;      /* high hash bits taken by the levels above */
+    int nbits;          /* log2 of the number of partitions */
+    BufFile **files;    /* created on first write */
+    uint64 *ncodes;     /* k-mers written to every file */
+} kmer_count_spill;
+
+/* Each open file holds a buffer of BLCKSZ bytes */
+#define KMER_COUNT_MAX_PARTITION_BITS  8
+
+/*
+ * Start spilling up to ndistinct distinct k-mers, with enough partitions for
+ * each to fit in maxbytes if possible
+ */
+static void kmer_count_spill_init(kmer_count_spill *spill, int used_bits, double ndistinct, Size maxbytes) {
+    int nbits = 1;
+
+    while (nbits < KMER_COUNT_MAX_PARTITION_BITS &&
+           KMER_COUNT_BYTES(ndistinct) > ldexp((double) maxbytes, nbits))
+        nbits++;
+    spill->used_bits = used_bits;
+    spill->nbits = Min(nbits, 64 - used_bits);
+    spill->files = (BufFile **) palloc0(sizeof(BufFile *) << spill->nbits);
+    spill->ncodes = (uint64 *) palloc0(sizeof(uint64) << spill->nbits);
+}
+
+static void kmer_count_spill_add(kmer_count_spill *spill, uint64 code) {
+    int p = (int) ((kmer_mix64(code) << spill->used_bits) >> (64 - spill->nbits));
+
+    if (spill->files[p] == NULL)
+        spill->files[p] = BufFileCreateTemp(false);
+    BufFileWrite(spill->files[p], &code, sizeof(code));
+    spill->ncodes[p]++;
+}
+
+static void kmer_count_emit(ReturnSetInfo *rsinfo, kmer_count_table *table, kmer *result_kmer) {
+    Datum values[2];
+    bool nulls[2] = {false, false};
+
+    values[0] = KmerPGetDatum(result_kmer);
+    for (uint64 i = 0; i < table->size; i++) {
+        if (table->entries[i].count > 0) {
+            result_kmer->code = table->entries[i].code;
+            values[1] = Int64GetDatum(table->entries[i].count);
+            tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+        }
+    }
+    kmer_count_free(table);
+}
+
+/*
+ * Count and emit the k-mers of every spilled partition in turn, spilling the
+ * ones that overflow a partition to the next level
+ */
+static void kmer_count_spilled(ReturnSetInfo *rsinfo, kmer_count_spill *spill, MemoryContext cxt,
+                               Size maxbytes, kmer *result_kmer) {
+    for (int p = 0; p < (1 << spill->nbits); p++) {
+        BufFile *file = spill->files[p];
+        kmer_count_table *table;
+        kmer_count_spill inner = {0};
+        uint64 code;
+
+        if (file == NULL)
+            continue;
+        if (BufFileSeek(file, 0, 0, SEEK_SET) != 0)
+            ereport(ERROR, (errcode_for_file_access(),
+                            errmsg("could not rewind kmer_count temporary file")));
+
+        table = kmer_count_create(cxt, result_kmer->k, 0);
+        while (BufFileReadMaybeEOF(file, &code, sizeof(code), true) == sizeof(code)) {
+            if (kmer_count_add_bounded(table, code, 1, maxbytes))
+                continue;
+            if (inner.files == NULL)
+                kmer_count_spill_init(&inner, spill->used_bits + spill->nbits,
+                                      (double) (spill->ncodes[p] - table->used), maxbytes);
+            kmer_count_spill_add(&inner, code);
+        }
+        BufFileClose(file);
+
+        kmer_count_emit(rsinfo, table, result_kmer);
+        if (inner.files != NULL)
+            kmer_count_spilled(rsinfo, &inner, cxt, maxbytes, result_kmer);
+        CHECK_FOR_INTERRUPTS();
+    }
+    pfree(spill->files);
+    pfree(spill->ncodes);
+}
+
+/*
+ * Count the k-mers of a sequence in an open-addressing hash table keyed on the
+ * packed code. Once the table is as large as the hash memory limit allows, it
+ * only counts the k-mers it already holds, and new ones are spilled by hash to
+ * temporary files in the same pass; each file is then counted on its own. The
+ * result tuplestore spills to disk by itself.
+ */
+Datum
+kmer_count(PG_FUNCTION_ARGS) {
+    dna *dna_sequence = PG_GETARG_DNA_P(0);
+    int k = PG_GETARG_INT32(1);
+    bool canonical = PG_GETARG_BOOL(2);
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+    Size maxbytes = get_hash_memory_limit();
+    MemoryContext cxt;
+    kmer_count_table *table;
+    kmer_count_spill spill = {0};
+    dna_kmer_iter it;
+    kmer result_kmer;
+    uint64 code;
+    int start;
+    double ndistinct;
+
+    if (k <= 0 || k > dna_sequence->length || k > MAX_KMER_LEN) {
+        ereport(ERROR, (errmsg("Invalid k value: must be between 1 and min(sequence length, %d)", MAX_KMER_LEN)));
+    }
+
+    InitMaterializedSRF(fcinfo, 0);
+
+    /* At most one distinct k-mer per window, and never more than 4^k */
+    ndistinct = dna_sequence->length - k + 1;
+    if (k < MAX_KMER_LEN)
+        ndistinct = Min(ndistinct, ldexp(1.0, 2 * k));
+
+    cxt = AllocSetContextCreate(CurrentMemoryContext, "kmer_count", ALLOCSET_DEFAULT_SIZES);
+
+    memset(&result_kmer, 0, sizeof(kmer));
+    result_kmer.k = k;
+
+    table = kmer_count_create(cxt, k, 0);
+    dna_kmer_iter_init(&it, dna_sequence, k, canonical);
+    while (dna_kmer_iter_next(&it, &code, &start)) {
+        if (kmer_count_add_bounded(table, code, 1, maxbytes))
+            continue;
+        if (spill.files == NULL)
+            kmer_count_spill_init(&spill, 0, ndistinct - table->used, maxbytes);
+        kmer_count_spill_add(&spill, code);
+    }
+
+    kmer_count_emit(rsinfo, table, &result_kmer);
+    if (spill.files != NULL)
+        kmer_count_spilled(rsinfo, &spill, cxt, maxbytes, &result_kmer);
+
+    MemoryContextDelete(cxt);
+    PG_FREE_IF_COPY(dna_sequence, 0);
+    return (Datum) 0;
+}
+
+// kmer_spectrum aggregate
+Datum
+kmer_spectrum_transfn(PG_FUNCTION_ARGS) {
+    MemoryContext aggcontext;
+    kmer_count_table *state;
+    dna *dna_sequence;
+    dna_kmer_iter it;
+    uint64 code;
+    int start;
+    int k;
+    /* kmer_spectrum(dna, integer, boolean) counts canonical k-mers */
+    bool canonical = PG_NARGS() > 3 && !PG_ARGISNULL(3) && PG_GETARG_BOOL(3);
+
+    if (!AggCheckCallContext(fcinfo, &aggcontext))
+        elog(ERROR, "kmer_spectrum_transfn called in non-aggregate context");
+
+    state = PG_ARGISNULL(0) ? NULL : (kmer_count_table *) PG_GETARG_POINTER(0);
+    if (PG_ARGISNULL(1) || PG_ARGISNULL(2)) {
+        if (state == NULL)
+            PG_RETURN_NULL();
+        PG_RETURN_POINTER(state);
+    }
+
+    k = PG_GETARG_INT32(2);
+    if (k <= 0 || k > MAX_KMER_LEN) {
+        ereport(ERROR, (errmsg("Invalid k value: must be between 1 and %d", MAX_KMER_LEN)));
+    }
+    if (state == NULL)
+        state = kmer_count_create(aggcontext, k, 0);
+    else if (state->k != k)
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("k must be the same for all rows of kmer_spectrum")));
+
+    dna_sequence = PG_GETARG_DNA_P(1);
+    dna_kmer_iter_init(&it, dna_sequence, k, canonical);
+    while (dna_kmer_iter_next(&it, &code, &start))
+        kmer_count_add(state, code, 1);
+    PG_FREE_IF_COPY(dna_sequence, 1);
+
+    PG_RETURN_POINTER(state);
+}
+
+Datum
+kmer_spectrum_combinefn(PG_FUNCTION_ARGS) {
+    MemoryContext aggcontext;
+    kmer_count_table *state1;
+    kmer_count_table *state2;
+
+    if (!AggCheckCallContext(fcinfo, &aggcontext))
+        elog(ERROR, "kmer_spectrum_combinefn called in non-aggregate context");
+
+    state1 = PG_ARGISNULL(0) ? NULL : (kmer_count_table *) PG_GETARG_POINTER(0);
+    state2 = PG_ARGISNULL(1) ? NULL : (kmer_count_table *) PG_GETARG_POINTER(1);
+
+    if (state2 == NULL) {
+        if (state1 == NULL)
+            PG_RETURN_NULL();
+        PG_RETURN_POINTER(state1);
+    }
+    /*
+     * state2 does not live in the aggregate context and must not be kept as
+     * the result, so start from an empty state that does and merge into it
+     */
+    if (state1 == NULL)
+        state1 = kmer_count_create(aggcontext, state2->k, state2->used);
+
+    kmer_count_merge(state1, state2);
+    PG_RETURN_POINTER(state1);
+}
+
+/*
+ * Serialized state: k, the number of distinct k-mers, then (code, count) pairs
+ */
+Datum
+kmer_spectrum_serialfn(PG_FUNCTION_ARGS) {
+    kmer_count_table *state = (kmer_count_table *) PG_GETARG_POINTER(0);
+    StringInfoData buf;
+
+    if (!AggCheckCallContext(fcinfo, NULL))
+        elog(ERROR, "kmer_spectrum_serialfn called in non-aggregate context");
+
+    pq_begintypsend(&buf);
+    pq_sendint32(&buf, state->k);
+    pq_sendint64(&buf, state->used);
+    for (uint64 i = 0; i < state->size; i++) {
+        if (state->entries[i].count > 0) {
+            pq_sendint64(&buf, state->entries[i].code);
+            pq_sendint64(&buf, state->entries[i].count);
+        }
+    }
+    PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
+}
+
+Datum
+kmer_spectrum_deserialfn(PG_FUNCTION_ARGS) {
+    bytea *sstate = PG_GETARG_BYTEA_PP(0);
+    kmer_count_table *state;
+    StringInfoData buf;
+    int k;
+    int64 n;
+
+    if (!AggCheckCallContext(fcinfo, NULL))
+        elog(ERROR, "kmer_spectrum_deserialfn called in non-aggregate context");
+
+    initStringInfo(&buf);
+    appendBinaryStringInfo(&buf, VARDATA_ANY(sstate), VARSIZE_ANY_EXHDR(sstate));
+
+    k = pq_getmsgint(&buf, 4);
+    n = pq_getmsgint64(&buf);
+    state = kmer_count_create(CurrentMemoryContext, k, n);
+    for (int64 i = 0; i < n; i++) {
+        uint64 code = pq_getmsgint64(&buf);
+        int64 count = pq_getmsgint64(&buf);
+        kmer_count_add(state, code, count);
+    }
+    pq_getmsgend(&buf);
+    pfree(buf.data);
+
+    PG_RETURN_POINTER(state);
+}
+
+/*
+ * The k-mer spectrum: element i of the result is the number of distinct k-mers
+ * seen exactly i times; the last element also counts all more frequent k-mers.
+ */
+Datum
+kmer_spectrum_finalfn(PG_FUNCTION_ARGS) {
+    kmer_count_table *state = (kmer_count_table *) PG_GETARG_POINTER(0);
+    int64 maxcount = 0;
+    int nbins;
+    int64 *bins;
+    Datum *elems;
+
+    for (uint64 i = 0; i < state->size; i++)
+        maxcount = Max(maxcount, state->entries[i].count);
+
+    nbins = (int) Min(maxcount, KMER_SPECTRUM_MAX_COUNT);
+    bins = (int64 *) palloc0(sizeof(int64) * Max(nbins, 1));
+    for (uint64 i = 0; i < state->size; i++) {
+        if (state->entries[i].count > 0)
+            bins[Min(state->entries[i].count, nbins) - 1]++;
+    }
+
+    elems = (Datum *) palloc(sizeof(Datum) * Max(nbins, 1));
+    for (int i = 0; i < nbins; i++)
+        elems[i] = Int64GetDatum(bins[i]);
+    PG_RETURN_ARRAYTYPE_P(construct_array_builtin(elems, nbins, INT8OID));
+}
+
+// BTree functions
+Datum
+kmer_lt(PG_FUNCTION_ARGS) {
+    kmer *a = PG_GETARG_KMER_P(0);
+    kmer *b = PG_GETARG_KMER_P(1);
+    PG_RETURN_BOOL(kmer_cmp_internal(a, b) < 0);
+}
+
+Datum
+kmer_le(PG_FUNCTION_ARGS) {
+    kmer *a = PG_GETARG_KMER_P(0);
+    kmer *b = PG_GETARG_KMER_P(1);
+    PG_RETURN_BOOL(kmer_cmp_internal(a, b) <= 0);
+}
+
+Datum
+kmer_gt(PG_FUNCTION_ARGS) {
+    kmer *a = PG_GETARG_KMER_P(0);
+    kmer *b = PG_GETARG_KMER_P(1);
+    PG_RETURN_BOOL(kmer_cmp_internal(a, b) > 0);
+}
+
+Datum
+kmer_ge(PG_FUNCTION_ARGS) {
+    kmer *a = PG_GETARG_KMER_P(0);
+    kmer *b = PG_GETARG_KMER_P(1);
+    PG_RETURN_BOOL(kmer_cmp_internal(a, b) >= 0);
+}
+
+Datum
+kmer_cmp(PG_FUNCTION_ARGS) {
+    kmer *a = PG_GETARG_KMER_P(0);
+    kmer *b = PG_GETARG_KMER_P(1);
+    PG_RETURN_INT32(kmer_cmp_internal(a, b));
+}
+
+/*
+ * SortSupport comparator, avoiding the fmgr call of kmer_cmp
+ */
+static int
+kmer_fastcmp(Datum x, Datum y, SortSupport ssup)
+{
+    return kmer_cmp_internal(DatumGetKmerP(x), DatumGetKmerP(y));
+}
+
+/*
+ * The abbreviated key is the left-aligned code itself: it orders exactly like
+ * the full value except that a kmer and its prefixes (trailing A's) tie, and
+ * those ties are resolved by the full comparator.
+ */
+static Datum
+kmer_abbrev_convert(Datum original, SortSupport ssup)
+{
+    return UInt64GetDatum(DatumGetKmerP(original)->code);
+}
+
+/*
+ * The conversion is cheap and the keys rarely tie, so never abort
+ */
+static bool
+kmer_abbrev_abort(int memtupcount, SortSupport ssup)
+{
+    return false;
+}
+
+Datum
+kmer_sortsupport(PG_FUNCTION_ARGS) {
+    SortSupport ssup = (SortSupport) PG_GETARG_POINTER(0);
+
+    ssup->comparator = kmer_fastcmp;
+#if SIZEOF_DATUM >= 8
+    if (ssup->abbreviate) {
+        ssup->abbrev_converter = kmer_abbrev_convert;
+        ssup->abbrev_abort = kmer_abbrev_abort;
+        ssup->abbrev_full_comparator = kmer_fastcmp;
+        ssup->comparator = ssup_datum_unsigned_cmp;
+    }
+#endif
+    PG_RETURN_VOID();
+}
+
+// Hash function
+Datum
+kmer_hash(PG_FUNCTION_ARGS) {
+    kmer *a = PG_GETARG_KMER_P(0);
+    PG_RETURN_INT32((int32) kmer_hash_internal(a, 0));
+}
+
+Datum
+kmer_hash_extended(PG_FUNCTION_ARGS) {
+    kmer *a = PG_GETARG_KMER_P(0);
+    uint64 seed = (uint64) PG_GETARG_INT64(1);
+    PG_RETURN_INT64((int64) kmer_hash_internal(a, seed));
+}
+
+// Statistics and selectivity estimation
+
+/* Standard statistics routine wrapped by the typanalyze functions below */
+typedef struct
+{
+    AnalyzeAttrComputeStatsFunc std_compute_stats;
+    void       *std_extra_data;
+} AnalyzeExtraData;
+
+/*
+ * For dna, ANALYZE adds a numbers-only slot holding the average number of
+ * bases, read from the headers only so that long sequences are not detoasted.
+ */
+static void
+compute_dna_stats(VacAttrStats *stats, AnalyzeAttrFetchFunc fetchfunc,
+                  int samplerows, double totalrows)
+{
+    AnalyzeExtraData *extra_data = (AnalyzeExtraData *) stats->extra_data;
+    double      total_length = 0;
+    int64       nonnull = 0;
+    int         slot;
+    float4     *avglength;
+    MemoryContext old_cxt;
+
+    stats->extra_data = extra_data->std_extra_data;
+    extra_data->std_compute_stats(stats, fetchfunc, samplerows, totalrows);
+    stats->extra_data = extra_data;
+
+    for (int i = 0; i < samplerows; i++)
+    {
+        bool        isnull;
+        Datum       value;
+        dna        *header;
+
+        vacuum_delay_point();
+
+        value = fetchfunc(stats, i, &isnull);
+        if (isnull)
+            continue;
+        header = (dna *) PG_DETOAST_DATUM_SLICE(value, 0, DNA_HDRSZ);
+        total_length += header->length;
+        nonnull++;
+        if ((Pointer) header != DatumGetPointer(value))
+            pfree(header);
+    }
+
+    if (!stats->stats_valid || nonnull == 0)
+        return;
+
+    for (slot = 0; slot < STATISTIC_NUM_SLOTS && stats->stakind[slot] != 0; slot++)
+        ;
+    if (slot >= STATISTIC_NUM_SLOTS)
+        return;
+
+    old_cxt = MemoryContextSwitchTo(stats->anl_context);
+    avglength = (float4 *) palloc(sizeof(float4));
+    avglength[0] = total_length / nonnull;
+    stats->stakind[slot] = STATISTIC_KIND_DNA_LENGTH;
+    stats->staop[slot] = InvalidOid;
+    stats->stacoll[slot] = InvalidOid;
+    stats->stanumbers[slot] = avglength;
+    stats->numnumbers[slot] = 1;
+    stats->numvalues[slot] = 0;
+    MemoryContextSwitchTo(old_cxt);
+}
+
+Datum
+dna_typanalyze(PG_FUNCTION_ARGS)
+{
+    VacAttrStats *stats = (VacAttrStats *) PG_GETARG_POINTER(0);
+    AnalyzeExtraData *extra_data;
+
+    if (!std_typanalyze(stats))
+        PG_RETURN_BOOL(false);
+
+    extra_data = (AnalyzeExtraData *) palloc(sizeof(AnalyzeExtraData));
+    extra_data->std_compute_stats = stats->compute_stats;
+    extra_data->std_extra_data = stats->extra_data;
+    stats->extra_data = extra_data;
+    stats->compute_stats = compute_dna_stats;
+    PG_RETURN_BOOL(true);
+}
+
+/*
+ * ANALYZE keeps the standard MCV list and histogram (kmer has a default btree
+ * opclass) and adds two numbers-only slots: the fraction of values of every
+ * length and, for every position, the frequency of each base among the values
+ * long enough to have that position.
+ */
+static void
+compute_kmer_stats(VacAttrStats *stats, AnalyzeAttrFetchFunc fetchfunc,
+                   int samplerows, double totalrows)
+{
+    AnalyzeExtraData *extra_data = (AnalyzeExtraData *) stats->extra_data;
+    int64       lengths[MAX_KMER_LEN + 1] = {0};
+    int64       bases[MAX_KMER_LEN][VALID_NUCLEOTIDES] = {{0}};
+    int64       nonnull = 0;
+    int64       longer;
+    int         slot;
+    float4     *lengthfreqs;
+    float4     *basefreqs;
+    MemoryContext old_cxt;
+
+    /* Let the standard code compute the MCVs and the histogram */
+    stats->extra_data = extra_data->std_extra_data;
+    extra_data->std_compute_stats(stats, fetchfunc, samplerows, totalrows);
+    stats->extra_data = extra_data;
+
+    for (int i = 0; i < samplerows; i++)
+    {
+        bool        isnull;
+        Datum       value;
+        kmer       *c;
+
+        vacuum_delay_point();
+
+        value = fetchfunc(stats, i, &isnull);
+        if (isnull)
+            continue;
+        c = DatumGetKmerP(value);
+        nonnull++;
+        lengths[c->k]++;
+        for (int p = 0; p < c->k; p++)
+            bases[p][KMER_BASE_AT(c, p)]++;
+    }
+
+    if (!stats->stats_valid || nonnull == 0)
+        return;
+
+    /* Both slots go after the ones the standard code filled */
+    for (slot = 0; slot < STATISTIC_NUM_SLOTS && stats->stakind[slot] != 0; slot++)
+        ;
+    if (slot + 2 > STATISTIC_NUM_SLOTS)
+        return;
+
+    old_cxt = MemoryContextSwitchTo(stats->anl_context);
+
+    lengthfreqs = (float4 *) palloc(sizeof(float4) * (MAX_KMER_LEN + 1));
+    for (int k = 0; k <= MAX_KMER_LEN; k++)
+        lengthfreqs[k] = (double) lengths[k] / nonnull;
+    stats->stakind[slot] = STATISTIC_KIND_KMER_LENGTH;
+    stats->staop[slot] = InvalidOid;
+    stats->stacoll[slot] = InvalidOid;
+    stats->stanumbers[slot] = lengthfreqs;
+    stats->numnumbers[slot] = MAX_KMER_LEN + 1;
+    stats->numvalues[slot] = 0;
+    slot++;
+
+    basefreqs = (float4 *) palloc0(sizeof(float4) * MAX_KMER_LEN * VALID_NUCLEOTIDES);
+    longer = nonnull - lengths[0];
+    for (int p = 0; p < MAX_KMER_LEN && longer > 0; p++)
+    {
+        for (int b = 0; b < VALID_NUCLEOTIDES; b++)
+            basefreqs[p * VALID_NUCLEOTIDES + b] = (double) bases[p][b] / longer;
+        longer -= lengths[p + 1];
+    }
+    stats->stakind[slot] = STATISTIC_KIND_KMER_BASES;
+    stats->staop[slot] = InvalidOid;
+    stats->stacoll[slot] = InvalidOid;
+    stats->stanumbers[slot] = basefreqs;
+    stats->numnumbers[slot] = MAX_KMER_LEN * VALID_NUCLEOTIDES;
+    stats->numvalues[slot] = 0;
+
+    MemoryContextSwitchTo(old_cxt);
+}
+
+Datum
+kmer_typanalyze(PG_FUNCTION_ARGS)
+{
+    VacAttrStats *stats = (VacAttrStats *) PG_GETARG_POINTER(0);
+    AnalyzeExtraData *extra_data;
+
+    if (!std_typanalyze(stats))
+        PG_RETURN_BOOL(false);
+
+    extra_data = (AnalyzeExtraData *) palloc(sizeof(AnalyzeExtraData));
+    extra_data->std_compute_stats = stats->compute_stats;
+    extra_data->std_extra_data = stats->extra_data;
+    stats->extra_data = extra_data;
+    stats->compute_stats = compute_kmer_stats;
+    PG_RETURN_BOOL(true);
+}
+
+/*
+ * Estimate the fraction of values matching the per-position base sets of
+ * pattern from the length and base statistics, assuming independent
+ * positions. With prefix, longer values match too. Without statistics, bases
+ * are taken as uniform and lengths as matching.
+ */
+static double
+kmer_pattern_heuristic_sel(VariableStatData *vardata, const qkmer_pattern *pattern, bool prefix)
+{
+    AttStatsSlot lengthslot;
+    AttStatsSlot baseslot;
+    bool        haveLengths = false;
+    bool        haveBases = false;
+    double      selec = 1.0;
+
+    if (HeapTupleIsValid(vardata->statsTuple))
+    {
+        haveLengths = get_attstatsslot(&lengthslot, vardata->statsTuple,
+                                       STATISTIC_KIND_KMER_LENGTH, InvalidOid,
+                                       ATTSTATSSLOT_NUMBERS);
+        if (haveLengths && lengthslot.nnumbers != MAX_KMER_LEN + 1)
+        {
+            free_attstatsslot(&lengthslot);
+            haveLengths = false;
+        }
+        haveBases = get_attstatsslot(&baseslot, vardata->statsTuple,
+                                     STATISTIC_KIND_KMER_BASES, InvalidOid,
+                                     ATTSTATSSLOT_NUMBERS);
+        if (haveBases && baseslot.nnumbers != MAX_KMER_LEN * VALID_NUCLEOTIDES)
+        {
+            free_attstatsslot(&baseslot);
+            haveBases = false;
+        }
+    }
+
+    if (haveLengths)
+    {
+        double      lengthsel = 0.0;
+
+        for (int k = pattern->k; k <= (prefix ? MAX_KMER_LEN : pattern->k); k++)
+            lengthsel += lengthslot.numbers[k];
+        selec *= lengthsel;
+        free_attstatsslot(&lengthslot);
+    }
+
+    for (int p = 0; p < pattern->k; p++)
+    {
+        double      possel = 0.0;
+
+        for (int b = 0; b < VALID_NUCLEOTIDES; b++)
+        {
+            if ((pattern->allow[b] >> (62 - 2 * p)) & 1)
+                possel += haveBases ? baseslot.numbers[p * VALID_NUCLEOTIDES + b] : 0.25;
+        }
+        selec *= possel;
+    }
+    if (haveBases)
+        free_attstatsslot(&baseslot);
+
+    return selec;
+}
+
+/*
+ * Selectivity of a prefix or pattern match of a kmer column against a
+ * constant, following patternsel: MCVs are tested directly, the rest is
+ * estimated from the histogram when it is large enough and from the
+ * position statistics otherwise.
+ */
+static double
+kmer_matchsel(PlannerInfo *root, Oid operator, List *args, int varRelid,
+              bool kmerOnLeft, bool prefix)
+{
+    VariableStatData vardata;
+    Node       *other;
+    bool        varonleft;
+    Datum       constval;
+    qkmer_pattern pattern;
+    FmgrInfo    opproc;
+    double      selec,
+                heursel,
+                mcv_selec,
+                sumcommon = 0.0,
+                nullfrac = 0.0;
+    int         hist_size;
+
+    if (!get_restriction_variable(root, args, varRelid,
+                                  &vardata, &other, &varonleft))
+        return DEFAULT_MATCH_SEL;
+
+    /* Only a kmer column compared with a constant can be estimated */
+    if (varonleft != kmerOnLeft || !IsA(other, Const))
+    {
+        ReleaseVariableStats(vardata);
+        return DEFAULT_MATCH_SEL;
+    }
+    if (((Const *) other)->constisnull)
+    {
+        ReleaseVariableStats(vardata);
+        return 0.0;
+    }
+    constval = ((Const *) other)->constvalue;
+
+    if (prefix)
+    {
+        kmer       *p = DatumGetKmerP(constval);
+
+        memset(&pattern, 0, sizeof(qkmer_pattern));
+        pattern.k = p->k;
+        for (int i = 0; i < p->k; i++)
+            pattern.allow[KMER_BASE_AT(p, i)] |= UINT64CONST(1) << (62 - 2 * i);
+    }
+    else
+        qkmer_compile(DatumGetQkmerP(constval), &pattern);
+
+    heursel = kmer_pattern_heuristic_sel(&vardata, &pattern, prefix);
+    if (!HeapTupleIsValid(vardata.statsTuple))
+    {
+        ReleaseVariableStats(vardata);
+        return heursel;
+    }
+
+    nullfrac = ((Form_pg_statistic) GETSTRUCT(vardata.statsTuple))->stanullfrac;
+    fmgr_info(get_opcode(operator), &opproc);
+
+    selec = histogram_selectivity(&vardata, &opproc, InvalidOid, constval,
+                                  varonleft, 10, 1, &hist_size);
+    /* If not at least 100 entries, blend in the heuristic estimate */
+    if (hist_size < 100)
+    {
+        if (selec < 0)
+            selec = heursel;
+        else
+        {
+            double      hist_weight = hist_size / 100.0;
+
+            selec = selec * hist_weight + heursel * (1.0 - hist_weight);
+        }
+    }
+
+    /* Keep it away from 0 and 1, the histogram excludes the MCVs anyway */
+    if (selec < 0.0001)
+        selec = 0.0001;
+    else if (selec > 0.9999)
+        selec = 0.9999;
+
+    mcv_selec = mcv_selectivity(&vardata, &opproc, InvalidOid, constval,
+                                varonleft, &sumcommon);
+    selec *= 1.0 - nullfrac - sumcommon;
+    selec += mcv_selec;
+
+    ReleaseVariableStats(vardata);
+    CLAMP_PROBABILITY(selec);
+    return selec;
+}
+
+/* Restriction selectivity of kmer ^@ kmer */
+Datum
+kmer_starts_with_sel(PG_FUNCTION_ARGS)
+{
+    PG_RETURN_FLOAT8(kmer_matchsel((PlannerInfo *) PG_GETARG_POINTER(0),
+                                   PG_GETARG_OID(1),
+                                   (List *) PG_GETARG_POINTER(2),
+                                   PG_GETARG_INT32(3), true, true));
+}
+
+/* Restriction selectivity of qkmer @> kmer */
+Datum
+kmer_contains_sel(PG_FUNCTION_ARGS)
+{
+    PG_RETURN_FLOAT8(kmer_matchsel((PlannerInfo *) PG_GETARG_POINTER(0),
+                                   PG_GETARG_OID(1),
+                                   (List *) PG_GETARG_POINTER(2),
+                                   PG_GETARG_INT32(3), false, false));
+}
+
+/* Restriction selectivity of kmer <@ qkmer */
+Datum
+kmer_contained_sel(PG_FUNCTION_ARGS)
+{
+    PG_RETURN_FLOAT8(kmer_matchsel((PlannerInfo *) PG_GETARG_POINTER(0),
+                                   PG_GETARG_OID(1),
+                                   (List *) PG_GETARG_POINTER(2),
+                                   PG_GETARG_INT32(3), true, false));
+}
+
+// SP-GiST functions
+
+/*
+ * The SP-GiST opclass is a radix tree over the 2-bit bases: every inner tuple
+ * has at most four child nodes labelled with the base code (0-3) that follows
+ * its prefix, plus a node labelled -1 for values ending right after the
+ * prefix (and -2 for the dummy node of an allTheSame tuple). Prefixes and
+ * leaf suffixes are packed kmers.
+ */
+#define KMER_NODE_END       -1
+#define KMER_NODE_DUMMY     -2
+
+Datum
+spgist_kmer_config(PG_FUNCTION_ARGS) {
+    spgConfigIn *cfgin = (spgConfigIn *) PG_GETARG_POINTER(0);
+    spgConfigOut *cfg = (spgConfigOut *) PG_GETARG_POINTER(1);
+
+    cfg->prefixType = cfgin->attType; // prefixes are kmers as well
+    cfg->labelType = INT2OID; // 2-bit base code of the child node
+    cfg->canReturnData = true; // true so index can return data when queried
+    cfg->longValuesOK = false; 
+    PG_RETURN_VOID();
+}
+
+/*
+ * Form a kmer datum from len bases of src starting at base start
+ */
+static
+Datum formKmerDatum(const kmer *src, int start, int len) {
+    uint64 code = (src == NULL || start >= MAX_KMER_LEN) ? 0 : src->code << (2 * start);
+    return KmerPGetDatum(kmer_from_code(len, code));
+}
+
+/*
+ * Find the length of the common prefix of a (from base aoff) and b (from base
+ * boff): the number of leading zero bit pairs of the difference of the codes
+ */
+static int
+commonPrefix(const kmer *a, int aoff, const kmer *b, int boff)
+{
+    int         maxLen = Min(a->k - aoff, b->k - boff);
+    uint64      diff;
+
+    if (maxLen <= 0)
+        return 0;
+    diff = (a->code << (2 * aoff)) ^ (b->code << (2 * boff));
+    if (diff == 0)
+        return maxLen;
+    return Min(maxLen, (63 - pg_leftmost_one_pos64(diff)) / 2);
+}
+
+/*
+ * Binary search an array of int16 datums for a match to c
+ *
+ * On success, *i gets the match location; on failure, it gets where to insert
+ */
+static bool
+searchChar(Datum *nodeLabels, int nNodes, int16 c, int *i)
+{
+    int            StopLow = 0,
+                StopHigh = nNodes;
+
+    while (StopLow < StopHigh)
+    {
+        int            StopMiddle = (StopLow + StopHigh) >> 1;
+        int16        middle = DatumGetInt16(nodeLabels[StopMiddle]);
+
+        if (c < middle)
+            StopHigh = StopMiddle;
+        else if (c > middle)
+            StopLow = StopMiddle + 1;
+        else
+        {
+            *i = StopMiddle;
+            return true;
+        }
+    }
+
+    *i = StopHigh;
+    return false;
+}
+
+Datum
+spgist_kmer_choose(PG_FUNCTION_ARGS) {
+    spgChooseIn *in = (spgChooseIn *) PG_GETARG_POINTER(0);
+    spgChooseOut *out = (spgChooseOut *) PG_GETARG_POINTER(1);
+
+    kmer    *inKmer = DatumGetKmerP(in->datum);
+    int      inK = inKmer->k;
+    kmer    *prefixKmer = NULL;
+    int      prefixK = 0;
+    int      commonLen = 0;
+    int16    nodeChar = 0;
+    int      i = 0;
+
+    /* Check for prefix match, set nodeChar to first base after prefix */
+    if (in->hasPrefix)
+    {
+        prefixKmer = DatumGetKmerP(in->prefixDatum);
+        prefixK = prefixKmer->k;
+
+        commonLen = commonPrefix(inKmer, in->level, prefixKmer, 0);
+
+        if (commonLen == prefixK)
+        {
+            /* node label --- first non-common base */
+            if (inK - in->level > commonLen)
+                nodeChar = KMER_BASE_AT(inKmer, in->level + commonLen);
+            else
+                nodeChar = KMER_NODE_END; /* completely common values */
+        }
+        else /* Not match prefix  -> split tuple */
+        {
             out->resultType = spgSplitTuple;
 
             if (commonLen == 0)
@@ -435,13 +2621,13 @@ spgist_kmer_choose(PG_FUNCTION_ARGS) {
             {
                 out->result.splitTuple.prefixHasPrefix = true;
                 out->result.splitTuple.prefixPrefixDatum =
-                    formKmerDatum(prefixData, commonLen);
+                    formKmerDatum(prefixKmer, 0, commonLen);
             }
             out->result.splitTuple.prefixNNodes = 1;
             out->result.splitTuple.prefixNodeLabels =
                 (Datum *) palloc(sizeof(Datum));
             out->result.splitTuple.prefixNodeLabels[0] =
-                Int16GetDatum(*(unsigned char *) (prefixData + commonLen));
+                Int16GetDatum(KMER_BASE_AT(prefixKmer, commonLen));
 
             out->result.splitTuple.childNodeN = 0;
 
@@ -453,7 +2639,7 @@ spgist_kmer_choose(PG_FUNCTION_ARGS) {
             {
                 out->result.splitTuple.postfixHasPrefix = true;
                 out->result.splitTuple.postfixPrefixDatum =
-                    formKmerDatum(prefixData + commonLen + 1, prefixK - commonLen - 1);
+                    formKmerDatum(prefixKmer, commonLen + 1, prefixK - commonLen - 1);
             }
 
             PG_RETURN_VOID();
@@ -461,11 +2647,11 @@ spgist_kmer_choose(PG_FUNCTION_ARGS) {
     }
     else if (inK > in->level)
     {
-        nodeChar = *(unsigned char *) (inData + in->level); /* node label = 1st character after the current level */
+        nodeChar = KMER_BASE_AT(inKmer, in->level); /* node label = 1st base after the current level */
     }
     else
     {
-        nodeChar = -1;
+        nodeChar = KMER_NODE_END;
     }
 
     /* Look up nodeChar in the node label array */
@@ -483,12 +2669,12 @@ spgist_kmer_choose(PG_FUNCTION_ARGS) {
         if (inK - in->level - levelAdd > 0)
         {
             out->result.matchNode.restDatum =
-                formKmerDatum(inData + in->level + levelAdd,
+                formKmerDatum(inKmer, in->level + levelAdd,
                               inK - in->level - levelAdd);
         }
         else
         {
-            out->result.matchNode.restDatum = formKmerDatum(NULL, 0);
+            out->result.matchNode.restDatum = formKmerDatum(NULL, 0, 0);
         }
     }
     else if (in->allTheSame)
@@ -499,7 +2685,7 @@ spgist_kmer_choose(PG_FUNCTION_ARGS) {
         out->result.splitTuple.prefixPrefixDatum = in->prefixDatum;
         out->result.splitTuple.prefixNNodes = 1;
         out->result.splitTuple.prefixNodeLabels = (Datum *) palloc(sizeof(Datum));
-        out->result.splitTuple.prefixNodeLabels[0] = Int16GetDatum(-2);
+        out->result.splitTuple.prefixNodeLabels[0] = Int16GetDatum(KMER_NODE_DUMMY);
         out->result.splitTuple.childNodeN = 0;
         out->result.splitTuple.postfixHasPrefix = false;
     }
@@ -544,21 +2730,13 @@ spgist_kmer_picksplit(PG_FUNCTION_ARGS) {
     for (i = 1; i < in->nTuples && commonLen > 0; i++)
     {
         kmer       *kmeri = DatumGetKmerP(in->datums[i]);
-		int         tmp = commonPrefix(kmer0->data,
-										kmeri->data,
-										kmer0->k,
-										kmeri->k);
+        int         tmp = commonPrefix(kmer0, 0, kmeri, 0);
 
         if (tmp < commonLen)
             commonLen = tmp;
     }
 
-    /*
-     * Limit the prefix length, if necessary, to ensure that the resulting
-     * inner tuple will fit on a page.
-     */
-
-    /* Set node prefix to be that string, if it's not empty */
+    /* Set node prefix to be that kmer, if it's not empty */
     if (commonLen == 0)
     {
         out->hasPrefix = false;
@@ -566,10 +2744,10 @@ spgist_kmer_picksplit(PG_FUNCTION_ARGS) {
     else
     {
         out->hasPrefix = true;
-        out->prefixDatum = formKmerDatum(kmer0->data, commonLen);
+        out->prefixDatum = formKmerDatum(kmer0, 0, commonLen);
     }
 
-    /* Extract the node label (first non-common byte) from each value */
+    /* Extract the node label (first non-common base) from each value */
     nodes = (spgNodePtr *) palloc(sizeof(spgNodePtr) * in->nTuples);
 
     for (i = 0; i < in->nTuples; i++)
@@ -577,9 +2755,9 @@ spgist_kmer_picksplit(PG_FUNCTION_ARGS) {
         kmer       *kmeri = DatumGetKmerP(in->datums[i]);
 
         if (commonLen < kmeri->k)
-            nodes[i].c = *(unsigned char *) (kmeri->data + commonLen);
+            nodes[i].c = KMER_BASE_AT(kmeri, commonLen);
         else
-            nodes[i].c = -1;    /* use -1 if string is all common */
+            nodes[i].c = KMER_NODE_END;    /* kmer is all common */
         nodes[i].i = i;
         nodes[i].d = in->datums[i];
     }
@@ -609,10 +2787,10 @@ spgist_kmer_picksplit(PG_FUNCTION_ARGS) {
         }
 
         if (commonLen < kmeri->k)
-            leafD = formKmerDatum(kmeri->data + commonLen + 1,
+            leafD = formKmerDatum(kmeri, commonLen + 1,
                                   kmeri->k - commonLen - 1);
         else
-            leafD = formKmerDatum(NULL, 0);
+            leafD = formKmerDatum(NULL, 0, 0);
 
         out->leafTupleDatums[nodes[i].i] = leafD;
         out->mapTuplesToNodes[nodes[i].i] = out->nNodes - 1;
@@ -621,288 +2799,482 @@ spgist_kmer_picksplit(PG_FUNCTION_ARGS) {
     PG_RETURN_VOID();
 }
 
+/*
+ * Lower bound of the Hamming distance between query and the values below a
+ * node whose reconstructed value is c. With isEnd, c is the only such value;
+ * otherwise the values extend c, so the bases of c the query lacks count too.
+ */
+static int
+kmerMinDistance(const kmer *query, const kmer *c, bool isEnd)
+{
+    if (isEnd)
+        return kmer_hamming_internal(query, c);
+    return kmer_mismatches(query->code, c->code, Min(query->k, c->k)) +
+           Max(0, c->k - query->k);
+}
+
+/*
+ * Check a scan key against the bases [from, to) of the reconstructed value c,
+ * whose bases before from were already checked higher up in the tree. With
+ * isEnd, the values below the node are exactly the first "to" bases of c.
+ */
+static bool
+innerKeyConsistent(FmgrInfo *flinfo, ScanKey key, const kmer *c,
+                   int from, int to, bool isEnd)
+{
+    kmer       *inKmer;
+    qkmer      *inQkmer;
+    int         upto;
+
+    switch (key->sk_strategy)
+    {
+        case EqualStrategyNumber:
+            inKmer = DatumGetKmerP(key->sk_argument);
+            if (isEnd ? inKmer->k != to : inKmer->k < to)
+                return false;
+            return ((inKmer->code ^ c->code) & KMER_RANGE_MASK(from, to)) == 0;
+        case StartsWithStrategyNumber:
+            inKmer = DatumGetKmerP(key->sk_argument);
+            if (isEnd && inKmer->k > to)
+                return false;
+            upto = Min(inKmer->k, to);
+            return upto <= from ||
+                   ((inKmer->code ^ c->code) & KMER_RANGE_MASK(from, upto)) == 0;
+        case ContainsStrategyNumber:
+            inQkmer = DatumGetQkmerP(key->sk_argument);
+            if (isEnd ? inQkmer->k != to : inQkmer->k < to)
+                return false;
+            return qkmer_pattern_matches(qkmer_cached_pattern(flinfo, inQkmer),
+                                         c->code, KMER_RANGE_MASK(from, to));
+        case HammingStrategyNumber:
+            inKmer = DatumGetKmerP(key->sk_argument);
+            return kmerMinDistance(inKmer, c, isEnd) <= hamming_threshold;
+        default:
+            elog(ERROR, "[Inner] unrecognized strategy number: %d",
+                key->sk_strategy);
+            return false;
+    }
+}
+
 Datum
 spgist_kmer_inner_consistent(PG_FUNCTION_ARGS){
-    // 
     spgInnerConsistentIn *in = (spgInnerConsistentIn *) PG_GETARG_POINTER(0);
-    // elog(NOTICE, "inner called, nkeys: %d", in->nkeys);
     spgInnerConsistentOut *out = (spgInnerConsistentOut *) PG_GETARG_POINTER(1);
-    // bool        collate_is_c = pg_newlocale_from_collation(PG_GET_COLLATION())->collate_is_c;
     kmer       *reconstructedValue;
-    kmer       *reconstrKmer;
-    int         maxReconstrLen;
+    kmer        reconstrKmer;
+    kmer       *nodeKmers;
     kmer       *prefixKmer = NULL;
     int         prefixSize = 0;
-    int         i;
+    int         i,
+                j;
 
     /*
-    * Reconstruct values represented at this tuple, including parent data,
-    * prefix of this tuple if any, and the node label if it's non-dummy.
-    * in->level should be the length of the previously reconstructed value,
-    * and the number of bytes added here is prefixSize or prefixSize + 1.
-    *
-    * Note: we assume that in->reconstructedValue isn't toasted and doesn't
-    * have a short varlena header.  This is okay because it must have been
-    * created by a previous invocation of this routine, and we always emit
-    * long-format reconstructed values.
+    * Reconstruct the value represented at this tuple: parent data plus the
+    * prefix of this tuple, if any. in->level is the length of the previously
+    * reconstructed value.
     */
     reconstructedValue = (kmer *) DatumGetPointer(in->reconstructedValue);
 
-    // Assert(reconstructedValue == NULL ? in->level == 0 :
-    //       (reconstructedValue->k) == in->level);
-
-    maxReconstrLen = in->level + 1;
-
+    memset(&reconstrKmer, 0, sizeof(kmer));
+    if (in->level)
+        reconstrKmer.code = reconstructedValue->code;
     if (in->hasPrefix) {
         prefixKmer = (kmer *) DatumGetPointer(in->prefixDatum);
-        prefixSize = (prefixKmer->k);
-        maxReconstrLen += prefixSize;
+        prefixSize = prefixKmer->k;
+        reconstrKmer.code |= prefixKmer->code >> (2 * in->level);
     }
-    // reconstrKmer = new reconstruction buffer
-    // The previously reconstructed value and any prefix
-    // will be copied to the new reconstruction buffer.
-    // elog(NOTICE, "[inner] reconstrKmer maxReconstrLen: %d, palloc: %d, pfsize: %d, in->level: %d", maxReconstrLen, VARHDRSZ + sizeof(int32) + maxReconstrLen + 1, prefixSize, in->level);
-    reconstrKmer = (kmer *) palloc(VARHDRSZ + sizeof(int32) + maxReconstrLen + 1);
-    SET_VARSIZE(reconstrKmer, VARHDRSZ + sizeof(int32) + maxReconstrLen + 1);
-    reconstrKmer->k = maxReconstrLen;
+    reconstrKmer.k = in->level + prefixSize;
 
-    if (in->level)
-        memcpy((reconstrKmer->data),
-               (reconstructedValue->data),
-               in->level);
-    if (prefixSize)
-        memcpy(((char *) (reconstrKmer->data)) + in->level,
-                (prefixKmer->data),
-                prefixSize);
-    /* last byte of reconstrKmer will be filled in below */
-    /*
-     * Scan the child nodes.  For each one, complete the reconstructed value
-     * and see if it's consistent with the query.  If so, emit an entry into
-     * the output arrays.
-     */
     out->nodeNumbers = (int *) palloc(sizeof(int) * in->nNodes);
     out->levelAdds = (int *) palloc(sizeof(int) * in->nNodes);
     out->reconstructedValues = (Datum *) palloc(sizeof(Datum) * in->nNodes);
+    if (in->norderbys > 0)
+        out->distances = (double **) palloc(sizeof(double *) * in->nNodes);
     out->nNodes = 0;
 
+    /* The prefix is shared by all child nodes, so check it only once */
+    for (j = 0; j < in->nkeys; j++) {
+        if (!innerKeyConsistent(fcinfo->flinfo, &in->scankeys[j], &reconstrKmer,
+                                in->level, reconstrKmer.k, false))
+            PG_RETURN_VOID();
+    }
+
+    /*
+     * The index AM copies the reconstructed values out of the temporary
+     * context, so one array of kmers for all the child nodes is enough.
+     */
+    nodeKmers = (kmer *) palloc(sizeof(kmer) * in->nNodes);
+
+    /*
+     * Scan the child nodes.  For each one, complete the reconstructed value
+     * with the node label and see if it's consistent with the query.  If so,
+     * emit an entry into the output arrays.
+     */
     for (i = 0; i < in->nNodes; i++) {
         int16   nodeChar = DatumGetInt16(in->nodeLabels[i]);
-        int     thisLen;
+        kmer   *nodeKmer = &nodeKmers[out->nNodes];
         bool    res = true;
-        int     j;
-
-        /* If nodeChar is a dummy value, don't include it in data */
-        if (nodeChar <= 0) {
-            thisLen = maxReconstrLen - 1;
-        } else {
-            ((unsigned char *) (reconstrKmer->data))[maxReconstrLen - 1] = nodeChar;
-            thisLen = maxReconstrLen;
-        }
-        ((unsigned char *) (reconstrKmer->data))[thisLen] = '\0';
-        for (j = 0; j < in->nkeys; j++) {
-            StrategyNumber strategy = in->scankeys[j].sk_strategy;
-            kmer    *inKmer;
-            qkmer   *inQkmer;
-            int      inSize;
-            int      r;
-
-            /*
-            * If it's a collation-aware operator, but the collation is C, we
-            * can treat it as non-collation-aware.  With non-C collation we
-            * need to traverse whole tree :-( so there's no point in making
-            * any check here.  (Note also that our reconstructed value may
-            * well end with a partial multibyte character, so that applying
-            * any encoding-sensitive test to it would be risky anyhow.)
-            */
-
-            inKmer = DatumGetKmerP(in->scankeys[j].sk_argument);
-            inSize = (inKmer->k);
-
-            size_t minLen = Min(inSize, thisLen);
-
-            
-            switch (strategy)
+
+        *nodeKmer = reconstrKmer;
+        if (nodeChar >= 0) {
+            nodeKmer->code |= (uint64) nodeChar << (62 - 2 * reconstrKmer.k);
+            nodeKmer->k++;
+        }
+
+        /* The dummy node of an allTheSame tuple adds nothing to check */
+        if (nodeChar != KMER_NODE_DUMMY) {
+            for (j = 0; j < in->nkeys; j++) {
+                if (!innerKeyConsistent(fcinfo->flinfo, &in->scankeys[j], nodeKmer,
+                                        reconstrKmer.k, nodeKmer->k,
+                                        nodeChar == KMER_NODE_END)) {
+                    res = false;
+                    break;      /* no need to consider remaining conditions */
+                }
+            }
+        }
+
+        if (res)
+        {
+            out->nodeNumbers[out->nNodes] = i;
+            out->levelAdds[out->nNodes] = nodeKmer->k - in->level;
+            out->reconstructedValues[out->nNodes] = KmerPGetDatum(nodeKmer);
+            if (in->norderbys > 0)
             {
-                case EqualStrategyNumber:
-                    r = 0;
-                    for (size_t i = 0; i < minLen; i++) {
-                        if (!nucleotide_matches(reconstrKmer->data[i], inKmer->data[i])) {
-                            r = reconstrKmer->data[i] - inKmer->data[i];
-                            break;
-                        }
-                    }
-                    if (r != 0 || inSize < thisLen)
-                        res = false;
-                    break;
-                case StartsWithStrategyNumber:
-                    r = 0;
-                    r = strncmp(inKmer->data, reconstrKmer->data, minLen);
-                    res = (r == 0);
-                    break;
-                case ContainsStrategyNumber:
-                    inQkmer = DatumGetQkmerP(in->scankeys[j].sk_argument);
-                    inSize = inQkmer->k;
-                    minLen = Min(inSize, thisLen);
-                    r = 0;
-                    for (size_t i = 0; i < minLen; i++) {
-                        if (!nucleotide_matches(inQkmer->data[i], reconstrKmer->data[i])) {
-                            r = reconstrKmer->data[i] - inKmer->data[i];
-                            break;
-                        }
-                    }
-                    if (r != 0 || inSize < thisLen)
-                        res = false;
-                    // elog(NOTICE, "[inner] CONTAINS: inQkmer: %s, k: %d, minLen: %d, reconst: %s, inSize: %d, thisLen: %d, r: %d", inQkmer->data, inQkmer->k, minLen, reconstrKmer->data, inSize, thisLen, r);
-                    break;
+                double *distances = (double *) palloc(sizeof(double) * in->norderbys);
+
+                for (j = 0; j < in->norderbys; j++)
+                    distances[j] = kmerMinDistance(DatumGetKmerP(in->orderbys[j].sk_argument),
+                                                   nodeKmer, nodeChar == KMER_NODE_END);
+                out->distances[out->nNodes] = distances;
             }
+            out->nNodes++;
+        }
+    }
+    PG_RETURN_VOID();
+}
 
-            if (!res)
-                break;          /* no need to consider remaining conditions */
+Datum
+spgist_kmer_leaf_consistent(PG_FUNCTION_ARGS)
+{
+    spgLeafConsistentIn *in = (spgLeafConsistentIn *) PG_GETARG_POINTER(0);
+    spgLeafConsistentOut *out = (spgLeafConsistentOut *) PG_GETARG_POINTER(1);
+    int         level = in->level;
+    kmer       *leafValue,
+               *reconstrValue = NULL;
+    kmer        fullKmer;
+    bool        res;
+    int         j;
+
+    out->recheck = false;
+
+    leafValue = DatumGetKmerP(in->leafDatum);
+
+    if (DatumGetPointer(in->reconstructedValue))
+        reconstrValue = (kmer *) DatumGetPointer(in->reconstructedValue);
+
+    /* Reconstruct the full kmer represented by this leaf tuple */
+    memset(&fullKmer, 0, sizeof(kmer));
+    if (level)
+        fullKmer.code = reconstrValue->code;
+    if (leafValue->k > 0)
+        fullKmer.code |= leafValue->code >> (2 * level);
+    fullKmer.k = level + leafValue->k;
+
+    /* Perform the required comparison(s) */
+    res = true;
+    for (j = 0; j < in->nkeys; j++)
+    {
+        StrategyNumber strategy = in->scankeys[j].sk_strategy;
+        kmer       *query;
+        qkmer      *inQkmer;
+
+        switch (strategy)
+        {
+            case EqualStrategyNumber:
+                query = DatumGetKmerP(in->scankeys[j].sk_argument);
+                res = query->k == fullKmer.k && query->code == fullKmer.code;
+                break;
+            case StartsWithStrategyNumber:
+                query = DatumGetKmerP(in->scankeys[j].sk_argument);
+                res = starts_with(query, &fullKmer);
+                break;
+            case ContainsStrategyNumber:
+                inQkmer = DatumGetQkmerP(in->scankeys[j].sk_argument);
+                res = inQkmer->k == fullKmer.k &&
+                      qkmer_pattern_matches(qkmer_cached_pattern(fcinfo->flinfo, inQkmer),
+                                            fullKmer.code, KMER_RANGE_MASK(level, fullKmer.k));
+                break;
+            case HammingStrategyNumber:
+                query = DatumGetKmerP(in->scankeys[j].sk_argument);
+                res = kmer_hamming_internal(query, &fullKmer) <= hamming_threshold;
+                break;
+            default:
+                elog(ERROR, "[Leaf] unrecognized strategy number: %d",
+                    in->scankeys[j].sk_strategy);
+                res = false;
+                break;
         }
 
-        if (res)
-        {
-            out->nodeNumbers[out->nNodes] = i;
-            out->levelAdds[out->nNodes] = thisLen - in->level;
-            SET_VARSIZE(reconstrKmer, VARHDRSZ + sizeof(int32) + thisLen + 1);
-            // elog(NOTICE, "[inner] out node: %s", reconstrKmer->data);
-            // if (thisLen == 32) {
-            //     elog(NOTICE, "[inner], reconstrKmer: %s", reconstrKmer->data);
-            // }
-            out->reconstructedValues[out->nNodes] =
-                datumCopy(KmerPGetDatum(reconstrKmer), false, -1);
-            out->nNodes++;
-        }
-    }
+        if (!res)
+            break;              /* no need to consider remaining conditions */
+    }
+
+    /* Leaf distances are exact */
+    if (res && in->norderbys > 0)
+    {
+        out->distances = (double *) palloc(sizeof(double) * in->norderbys);
+        for (j = 0; j < in->norderbys; j++)
+            out->distances[j] = kmer_hamming_internal(DatumGetKmerP(in->orderbys[j].sk_argument),
+                                                      &fullKmer);
+        out->recheckDistances = false;
+    }
+
+    /* Only pay for a copy of the value when the scan returns it */
+    if (res && in->returnData)
+        out->leafValue = KmerPGetDatum(kmer_from_code(fullKmer.k, fullKmer.code));
+    PG_RETURN_BOOL(res);
+}
+
+// BRIN functions
+
+/*
+ * Consistent function of the BRIN minmax opclass. The ranges summarize the
+ * minimum and maximum kmer in kmer_cmp order, which is lexicographic, so the
+ * kmers starting with P are the range [P, P·TTT...] and a prefix scan skips
+ * every block range not overlapping it.
+ */
+Datum
+kmer_brin_minmax_consistent(PG_FUNCTION_ARGS)
+{
+    BrinValues *column = (BrinValues *) PG_GETARG_POINTER(1);
+    ScanKey     key = (ScanKey) PG_GETARG_POINTER(2);
+    kmer       *min = DatumGetKmerP(column->bv_values[0]);
+    kmer       *max = DatumGetKmerP(column->bv_values[1]);
+    kmer       *query = DatumGetKmerP(key->sk_argument);
+    kmer        upper;
+    bool        matches;
+
+    switch (key->sk_strategy)
+    {
+        case BTLessStrategyNumber:
+            matches = kmer_cmp_internal(min, query) < 0;
+            break;
+        case BTLessEqualStrategyNumber:
+            matches = kmer_cmp_internal(min, query) <= 0;
+            break;
+        case BTEqualStrategyNumber:
+            matches = kmer_cmp_internal(min, query) <= 0 &&
+                      kmer_cmp_internal(max, query) >= 0;
+            break;
+        case BTGreaterEqualStrategyNumber:
+            matches = kmer_cmp_internal(max, query) >= 0;
+            break;
+        case BTGreaterStrategyNumber:
+            matches = kmer_cmp_internal(max, query) > 0;
+            break;
+        case BrinStartsWithStrategyNumber:
+            memset(&upper, 0, sizeof(kmer));
+            upper.code = query->code | ~KMER_MASK(query->k);
+            upper.k = MAX_KMER_LEN;
+            matches = kmer_cmp_internal(max, query) >= 0 &&
+                      kmer_cmp_internal(min, &upper) <= 0;
+            break;
+        default:
+            elog(ERROR, "invalid strategy number %d", key->sk_strategy);
+            matches = false;
+            break;
+    }
+
+    PG_RETURN_BOOL(matches);
+}
+
+// GIN functions
+
+/*
+ * The GIN opclass on dna indexes every distinct k-mer of a sequence, for the
+ * k given by the opclass option (default DNA_GIN_DEFAULT_K), as an int8 key
+ * holding the right-aligned packed code. A query extracts the k-mers it is
+ * sure to contain; the matching sequences are rechecked.
+ */
+Datum
+dna_gin_options(PG_FUNCTION_ARGS)
+{
+    local_relopts *relopts = (local_relopts *) PG_GETARG_POINTER(0);
+
+    init_local_reloptions(relopts, sizeof(DnaGinOptions));
+    add_local_int_reloption(relopts, "k",
+                            "length of the k-mers stored in the index",
+                            DNA_GIN_DEFAULT_K, 1, MAX_KMER_LEN,
+                            offsetof(DnaGinOptions, k));
     PG_RETURN_VOID();
 }
 
-Datum
-spgist_kmer_leaf_consistent(PG_FUNCTION_ARGS)
+static int
+dna_gin_k(FunctionCallInfo fcinfo)
 {
-    spgLeafConsistentIn *in = (spgLeafConsistentIn *) PG_GETARG_POINTER(0);
-    // elog(NOTICE, "leaf called, nkeys: %d", in->nkeys);
-    spgLeafConsistentOut *out = (spgLeafConsistentOut *) PG_GETARG_POINTER(1);
-    int         level = in->level;
-    kmer       *leafValue,
-               *reconstrValue = NULL;
-    char       *fullValue;
-    int         fullLen;
-    bool        res;
-    int         j;
+    if (PG_HAS_OPCLASS_OPTIONS())
+        return ((DnaGinOptions *) PG_GET_OPCLASS_OPTIONS())->k;
+    return DNA_GIN_DEFAULT_K;
+}
 
-    out->recheck = false;
+static inline Datum
+dna_gin_key(uint64 code, int k)
+{
+    return Int64GetDatum((int64) (code >> (64 - 2 * k)));
+}
 
-    leafValue = DatumGetKmerP(in->leafDatum);
+/* qsort comparator for int64 datums */
+static int
+cmpKeyDatum(const void *a, const void *b)
+{
+    int64       aa = DatumGetInt64(*(const Datum *) a);
+    int64       bb = DatumGetInt64(*(const Datum *) b);
 
-    /* As above, in->reconstructedValue isn't toasted or short. */
-    if (DatumGetPointer(in->reconstructedValue)) {
-        reconstrValue = (kmer *) DatumGetPointer(in->reconstructedValue);
-        // elog(NOTICE, "[leaf], leaf d: %s, leaf k: %d, level: %d, reconst: %s", leafValue->data, leafValue->k, level, reconstrValue->data);
-    } else {
-        // elog(NOTICE, "[leaf], leaf d: %s, leaf k: %d, level: %d, reconst NULL", leafValue->data, leafValue->k, level);
-    }
+    return (aa > bb) - (aa < bb);
+}
 
-    // Assert(reconstrValue == NULL ? level == 0 :
-    //     (reconstrValue->k) == level);
+/* Sort keys and remove duplicates, returning the new number of keys */
+static int32
+dna_gin_unique_keys(Datum *keys, int32 nkeys)
+{
+    int32       n = 0;
 
-    /* Reconstruct the full string represented by this leaf tuple */
-    fullLen = level + (leafValue->k);
-    // elog(NOTICE, "[leaf] fullLen = %d, palloc %d, level: %d", fullLen, VARHDRSZ + sizeof(int32) + fullLen + 1, level);
-    if ((leafValue->k) == 0 && level > 0)
-    {
-        fullValue = (reconstrValue->data);
-        out->leafValue = KmerPGetDatum(reconstrValue);
-    }
-    else
+    if (nkeys <= 1)
+        return nkeys;
+    qsort(keys, nkeys, sizeof(Datum), cmpKeyDatum);
+    for (int32 i = 1; i < nkeys; i++)
     {
-        kmer       *fullKmer = (kmer *) palloc(VARHDRSZ + sizeof(int32) + fullLen + 1);
-        SET_VARSIZE(fullKmer, VARHDRSZ + sizeof(int32) + fullLen + 1);
-        fullKmer->k = fullLen;
-        fullValue = (fullKmer->data);
-        if (level)
-            memcpy(fullValue, (reconstrValue->data), level);
-        if ((leafValue->k) > 0)
-            memcpy(fullValue + level, (char *) (leafValue->data),
-                (leafValue->k));
-        fullKmer->data[fullLen] = '\0';
-        out->leafValue = KmerPGetDatum(fullKmer);
+        if (keys[i] != keys[n])
+            keys[++n] = keys[i];
     }
+    return n + 1;
+}
 
-    /* Perform the required comparison(s) */
-    res = true;
-    for (j = 0; j < in->nkeys; j++)
+Datum
+dna_gin_extract_value(PG_FUNCTION_ARGS)
+{
+    dna        *seq = PG_GETARG_DNA_P(0);
+    int32      *nkeys = (int32 *) PG_GETARG_POINTER(1);
+    int         k = dna_gin_k(fcinfo);
+    kmer_count_table *table;
+    dna_kmer_iter it;
+    uint64      code;
+    int         start;
+    Datum      *keys = NULL;
+
+    *nkeys = 0;
+    if (seq->length < k)
+        PG_RETURN_POINTER(NULL);
+
+    /* Collect the distinct k-mers, at most 4^k of them */
+    table = kmer_count_create(CurrentMemoryContext, k,
+                              k < MAX_KMER_LEN ? Min(seq->length, ldexp(1.0, 2 * k)) : seq->length);
+    dna_kmer_iter_init(&it, seq, k, false);
+    while (dna_kmer_iter_next(&it, &code, &start))
+        kmer_count_add(table, code, 1);
+
+    keys = (Datum *) palloc(sizeof(Datum) * Max(table->used, 1));
+    for (uint64 i = 0; i < table->size; i++)
     {
-        StrategyNumber strategy = in->scankeys[j].sk_strategy;
-        kmer       *query = DatumGetKmerP(in->scankeys[j].sk_argument);
-        qkmer      *inQkmer;
-        int         queryLen = (query->k);
-        int         r;
-        kmer *leafKmer = DatumGetKmerP(out->leafValue);
-        // elog(NOTICE, "[leaf] leafKmer: %s", leafKmer->data);
+        if (table->entries[i].count > 0)
+            keys[(*nkeys)++] = dna_gin_key(table->entries[i].code, k);
+    }
+    kmer_count_free(table);
 
-        size_t minLen = Min(queryLen, fullLen);
+    PG_RETURN_POINTER(keys);
+}
 
+Datum
+dna_gin_extract_query(PG_FUNCTION_ARGS)
+{
+    int32      *nkeys = (int32 *) PG_GETARG_POINTER(1);
+    StrategyNumber strategy = PG_GETARG_UINT16(2);
+    int32      *searchMode = (int32 *) PG_GETARG_POINTER(6);
+    int         k = dna_gin_k(fcinfo);
+    Datum      *keys = NULL;
+
+    *nkeys = 0;
+    switch (strategy)
+    {
+        case GinContainsKmerStrategyNumber:
+        {
+            kmer       *query = PG_GETARG_KMER_P(0);
 
-        switch (strategy)
+            /* Every k-window of the query must be in the sequence */
+            if (query->k >= k)
+            {
+                keys = (Datum *) palloc(sizeof(Datum) * (query->k - k + 1));
+                for (int i = 0; i + k <= query->k; i++)
+                    keys[(*nkeys)++] = dna_gin_key(query->code << (2 * i), k);
+            }
+            break;
+        }
+        case GinContainsQkmerStrategyNumber:
         {
-            case EqualStrategyNumber:
-                r = 0;
-                for (size_t i = 0; i < minLen; i++) {
-                    if (!nucleotide_matches(query->data[i], fullValue[i])) {
-                        r = query->data[i] - fullValue[i];
-                        break;
-                    }
-                }
-                if (r == 0)
-                {
-                    if (queryLen > fullLen)
-                        r = -1;
-                    else if (queryLen < fullLen)
-                        r = 1;
-                }
-                res = (r == 0);
-                break;
-            case StartsWithStrategyNumber:
-                r = 0;
-                if (queryLen > fullLen) {
-                    res = false;
-                } else {
-                    r = strncmp(query->data, fullValue, queryLen);
-                }
-                res = (r == 0);
-                break;
-            case ContainsStrategyNumber:
-                inQkmer = DatumGetQkmerP(in->scankeys[j].sk_argument);
-                queryLen = inQkmer->k;
-                minLen = Min(queryLen, fullLen);
-                r = 0;
-                for (size_t i = 0; i < minLen; i++) {
-                    if (!nucleotide_matches(inQkmer->data[i], fullValue[i])) {
-                        r = inQkmer->data[i] - fullValue[i];
-                        break;
-                    }
-                }
-                if (r == 0)
+            qkmer      *query = PG_GETARG_QKMER_P(0);
+            int         run = 0;
+            uint64      window = 0;
+
+            /* Only the k-windows made of plain bases give keys */
+            if (query->k >= k)
+                keys = (Datum *) palloc(sizeof(Datum) * (query->k - k + 1));
+            for (int i = 0; i < query->k && query->k >= k; i++)
+            {
+                uint8       set = QKMER_SET_AT(query, i);
+
+                /* A plain base has a single bit set */
+                if (set == 0 || (set & (set - 1)) != 0)
                 {
-                    if (queryLen > fullLen)
-                        r = -1;
-                    else if (queryLen < fullLen)
-                        r = 1;
+                    run = 0;
+                    continue;
                 }
-                res = (r == 0);
-                break;
-            default:
-                elog(ERROR, "[Leaf] unrecognized strategy number: %d",
-                    in->scankeys[j].sk_strategy);
-                res = false;
-                break;
+                window = (window << 2) | pg_rightmost_one_pos32(set);
+                if (++run >= k)
+                    keys[(*nkeys)++] = dna_gin_key(window << (64 - 2 * k), k);
+            }
+            break;
         }
+        default:
+            elog(ERROR, "unrecognized strategy number: %d", strategy);
+    }
 
-        if (!res)
-            break;              /* no need to consider remaining conditions */
+    /* Nothing to look up: every sequence has to be rechecked */
+    if (*nkeys == 0)
+        *searchMode = GIN_SEARCH_MODE_ALL;
+    *nkeys = dna_gin_unique_keys(keys, *nkeys);
+
+    PG_RETURN_POINTER(keys);
+}
+
+Datum
+dna_gin_consistent(PG_FUNCTION_ARGS)
+{
+    bool       *check = (bool *) PG_GETARG_POINTER(0);
+    int32       nkeys = PG_GETARG_INT32(3);
+    bool       *recheck = (bool *) PG_GETARG_POINTER(5);
+
+    /* The k-mers may appear apart from each other, so always recheck */
+    *recheck = true;
+    for (int32 i = 0; i < nkeys; i++)
+    {
+        if (!check[i])
+            PG_RETURN_BOOL(false);
     }
-    PG_RETURN_BOOL(res);
+    PG_RETURN_BOOL(true);
+}
+
+Datum
+dna_gin_triconsistent(PG_FUNCTION_ARGS)
+{
+    GinTernaryValue *check = (GinTernaryValue *) PG_GETARG_POINTER(0);
+    int32       nkeys = PG_GETARG_INT32(3);
+
+    for (int32 i = 0; i < nkeys; i++)
+    {
+        if (check[i] == GIN_FALSE)
+            PG_RETURN_GIN_TERNARY_VALUE(GIN_FALSE);
+    }
+    PG_RETURN_GIN_TERNARY_VALUE(GIN_MAYBE);
 }
 
 // ********** qkmer **********
@@ -922,9 +3294,40 @@ Datum
 qkmer_out(PG_FUNCTION_ARGS) 
 {
     qkmer *c = PG_GETARG_QKMER_P(0);
-    char *result = pstrdup(c->data);
-    PG_FREE_IF_COPY(c, 0);
-    PG_RETURN_CSTRING(result);
+    PG_RETURN_CSTRING(qkmer_to_str(c));
+}
+
+/*
+ * Binary format: the length (byte) followed by the bytes of the masks that
+ * hold positions
+ */
+Datum
+qkmer_recv(PG_FUNCTION_ARGS)
+{
+    StringInfo buf = (StringInfo) PG_GETARG_POINTER(0);
+    qkmer *result = palloc0(sizeof(qkmer));
+
+    result->k = pq_getmsgbyte(buf);
+    if (result->k > MAX_KMER_LEN)
+        ereport(ERROR, (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+                        errmsg("invalid external qkmer value")));
+    pq_copymsgbytes(buf, (char *) result->masks, (result->k + 1) / 2);
+    if ((result->k & 1) != 0 && (result->masks[result->k / 2] & 0xF) != 0)
+        ereport(ERROR, (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+                        errmsg("invalid external qkmer value")));
+    PG_RETURN_QKMER_P(result);
+}
+
+Datum
+qkmer_send(PG_FUNCTION_ARGS)
+{
+    qkmer *c = PG_GETARG_QKMER_P(0);
+    StringInfoData buf;
+
+    pq_begintypsend(&buf);
+    pq_sendbyte(&buf, c->k);
+    pq_sendbytes(&buf, c->masks, (c->k + 1) / 2);
+    PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
 }
 
 Datum
@@ -951,6 +3354,8 @@ qkmer_constructor(PG_FUNCTION_ARGS)
 {
     int k = PG_GETARG_INT32(0);
     char *data = text_to_cstring(PG_GETARG_TEXT_PP(1));
+    if (k < 0 || k > MAX_KMER_LEN || k > (int) strlen(data))
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE), errmsg("Invalid k value: must be between 0 and min(text length, %d)", MAX_KMER_LEN)));
     PG_RETURN_QKMER_P(qkmer_make(k, data));
 }
 
@@ -971,7 +3376,8 @@ qkmer_contains(PG_FUNCTION_ARGS) {
     if (pattern->k != c->k) {
         result = false;
     } else {
-        result = contains(pattern->data, c->data);
+        result = qkmer_pattern_matches(qkmer_cached_pattern(fcinfo->flinfo, pattern),
+                                       c->code, KMER_MASK(c->k));
     }
     PG_FREE_IF_COPY(pattern, 0);
     PG_FREE_IF_COPY(c, 1);   
@@ -986,9 +3392,507 @@ qkmer_contains_swapped(PG_FUNCTION_ARGS) {
     if (pattern->k != c->k) {
         result = false;
     } else {
-        result = contains(pattern->data, c->data);
+        result = qkmer_pattern_matches(qkmer_cached_pattern(fcinfo->flinfo, pattern),
+                                       c->code, KMER_MASK(c->k));
     }
     PG_FREE_IF_COPY(pattern, 1);
     PG_FREE_IF_COPY(c, 0);   
     PG_RETURN_BOOL(result);
-}
\ No newline at end of file
+}
+// ********** dna_sketch **********
+/*
+ * Text I/O of dna_sketch and hll: "\x" and the hex of the binary format, as
+ * bytea prints it. The same binary format is their send/receive format and
+ * the serialized state of their aggregates; read and write convert a value
+ * from and to it.
+ */
+static void *
+hex_external_in(const char *str, const char *type, void *(*read) (StringInfo buf))
+{
+    size_t len = strlen(str);
+    StringInfoData buf;
+    void *result;
+
+    if (len < 2 || str[0] != '\\' || str[1] != 'x')
+        ereport(ERROR, (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION), errmsg("Invalid input syntax for type %s", type)));
+
+    initStringInfo(&buf);
+    enlargeStringInfo(&buf, (len - 2) / 2);
+    buf.len = hex_decode(str + 2, len - 2, buf.data);
+    result = read(&buf);
+    pq_getmsgend(&buf);
+    pfree(buf.data);
+    return result;
+}
+
+static char *
+hex_external_out(const void *value, void (*write) (StringInfo buf, const void *value))
+{
+    StringInfoData buf;
+    char *result;
+
+    initStringInfo(&buf);
+    write(&buf, value);
+    result = palloc(2 * buf.len + 3);
+    result[0] = '\\';
+    result[1] = 'x';
+    result[2 + hex_encode(buf.data, buf.len, result + 2)] = '\0';
+    pfree(buf.data);
+    return result;
+}
+
+Datum
+dna_sketch_in(PG_FUNCTION_ARGS) {
+    PG_RETURN_DNA_SKETCH_P(hex_external_in(PG_GETARG_CSTRING(0), "dna_sketch", dna_sketch_read));
+}
+
+Datum
+dna_sketch_out(PG_FUNCTION_ARGS) {
+    dna_sketch *sketch = PG_GETARG_DNA_SKETCH_P(0);
+    char *result = hex_external_out(sketch, dna_sketch_write);
+
+    PG_FREE_IF_COPY(sketch, 0);
+    PG_RETURN_CSTRING(result);
+}
+
+Datum
+dna_sketch_recv(PG_FUNCTION_ARGS) {
+    StringInfo buf = (StringInfo) PG_GETARG_POINTER(0);
+    PG_RETURN_DNA_SKETCH_P(dna_sketch_read(buf));
+}
+
+Datum
+dna_sketch_send(PG_FUNCTION_ARGS) {
+    dna_sketch *sketch = PG_GETARG_DNA_SKETCH_P(0);
+    StringInfoData buf;
+
+    pq_begintypsend(&buf);
+    dna_sketch_write(&buf, sketch);
+    PG_FREE_IF_COPY(sketch, 0);
+    PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
+}
+
+/* Check the parameters of sketch() and sketch_agg() */
+static void
+dna_sketch_check_params(int k, int size, int64 scaled)
+{
+    if (k <= 0 || k > MAX_KMER_LEN)
+        ereport(ERROR, (errmsg("Invalid k value: must be between 1 and %d", MAX_KMER_LEN)));
+    if (size < 0 || size > DNA_SKETCH_MAX_SIZE)
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("Invalid sketch size: must be between 0 and %d", (int) DNA_SKETCH_MAX_SIZE)));
+    if (scaled < 1)
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("Invalid scaled value: must be at least 1")));
+    if (size == 0 && scaled == 1)
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("A sketch needs a size or a scaled value above 1")));
+}
+
+/*
+ * Sketch of the canonical k-mers of a sequence: the size smallest hashes, or
+ * with size 0 the hashes below 2^64 / scaled
+ */
+Datum
+dna_sketch_build(PG_FUNCTION_ARGS) {
+    dna *dna_sequence = PG_GETARG_DNA_P(0);
+    int k = PG_GETARG_INT32(1);
+    int size = PG_GETARG_INT32(2);
+    int64 scaled = PG_GETARG_INT64(3);
+    dna_sketch_builder *builder;
+    dna_sketch *result;
+
+    dna_sketch_check_params(k, size, scaled);
+    builder = dna_sketch_builder_create(CurrentMemoryContext, k, size, DNA_SKETCH_MAX_HASH(scaled));
+    dna_sketch_builder_add_dna(builder, dna_sequence);
+    result = dna_sketch_builder_finish(builder);
+
+    pfree(builder->hashes);
+    pfree(builder);
+    PG_FREE_IF_COPY(dna_sequence, 0);
+    PG_RETURN_DNA_SKETCH_P(result);
+}
+
+Datum
+dna_sketch_length(PG_FUNCTION_ARGS) {
+    dna_sketch *sketch = (dna_sketch *) PG_DETOAST_DATUM_SLICE(PG_GETARG_DATUM(0), 0, DNA_SKETCH_HDRSZ - VARHDRSZ);
+    PG_RETURN_INT32(sketch->n);
+}
+
+/* Estimated Jaccard index of the k-mer sets of two sketches */
+static double
+dna_sketch_jaccard_internal(const dna_sketch *a, const dna_sketch *b)
+{
+    int64 common;
+    int64 na;
+    int64 nb;
+
+    dna_sketch_compare(a, b, &common, &na, &nb);
+    if (na + nb - common == 0)
+        return 0.0;
+    return (double) common / (double) (na + nb - common);
+}
+
+Datum
+dna_sketch_jaccard(PG_FUNCTION_ARGS) {
+    dna_sketch *a = PG_GETARG_DNA_SKETCH_P(0);
+    dna_sketch *b = PG_GETARG_DNA_SKETCH_P(1);
+    double result = dna_sketch_jaccard_internal(a, b);
+
+    PG_FREE_IF_COPY(a, 0);
+    PG_FREE_IF_COPY(b, 1);
+    PG_RETURN_FLOAT8(result);
+}
+
+/* Estimated fraction of the k-mers of the first sketch found in the second */
+Datum
+dna_sketch_containment(PG_FUNCTION_ARGS) {
+    dna_sketch *a = PG_GETARG_DNA_SKETCH_P(0);
+    dna_sketch *b = PG_GETARG_DNA_SKETCH_P(1);
+    int64 common;
+    int64 na;
+    int64 nb;
+
+    dna_sketch_compare(a, b, &common, &na, &nb);
+    PG_FREE_IF_COPY(a, 0);
+    PG_FREE_IF_COPY(b, 1);
+    PG_RETURN_FLOAT8(na == 0 ? 0.0 : (double) common / (double) na);
+}
+
+/*
+ * Mash distance, an estimate of the per-base mutation rate between the
+ * sequences under a Poisson model: -ln(2j / (1 + j)) / k, capped at 1
+ */
+Datum
+dna_sketch_mash_distance(PG_FUNCTION_ARGS) {
+    dna_sketch *a = PG_GETARG_DNA_SKETCH_P(0);
+    dna_sketch *b = PG_GETARG_DNA_SKETCH_P(1);
+    double j = dna_sketch_jaccard_internal(a, b);
+    double result = 1.0;
+
+    if (j > 0)
+        result = Min(-log(2.0 * j / (1.0 + j)) / a->k, 1.0);
+    PG_FREE_IF_COPY(a, 0);
+    PG_FREE_IF_COPY(b, 1);
+    PG_RETURN_FLOAT8(result);
+}
+
+// sketch_agg aggregate
+Datum
+sketch_agg_transfn(PG_FUNCTION_ARGS) {
+    MemoryContext aggcontext;
+    dna_sketch_builder *state;
+    dna *dna_sequence;
+    int k;
+    /* sketch_agg(dna, integer) keeps 1000 hashes */
+    int size = PG_NARGS() > 3 && !PG_ARGISNULL(3) ? PG_GETARG_INT32(3) : 1000;
+    int64 scaled = PG_NARGS() > 4 && !PG_ARGISNULL(4) ? PG_GETARG_INT64(4) : 1;
+
+    if (!AggCheckCallContext(fcinfo, &aggcontext))
+        elog(ERROR, "sketch_agg_transfn called in non-aggregate context");
+
+    state = PG_ARGISNULL(0) ? NULL : (dna_sketch_builder *) PG_GETARG_POINTER(0);
+    if (PG_ARGISNULL(1) || PG_ARGISNULL(2)) {
+        if (state == NULL)
+            PG_RETURN_NULL();
+        PG_RETURN_POINTER(state);
+    }
+
+    k = PG_GETARG_INT32(2);
+    if (state == NULL) {
+        dna_sketch_check_params(k, size, scaled);
+        state = dna_sketch_builder_create(aggcontext, k, size, DNA_SKETCH_MAX_HASH(scaled));
+    } else if (state->k != k || state->size != size || state->max_hash != DNA_SKETCH_MAX_HASH(scaled))
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("k, size and scaled must be the same for all rows of sketch_agg")));
+
+    dna_sequence = PG_GETARG_DNA_P(1);
+    dna_sketch_builder_add_dna(state, dna_sequence);
+    PG_FREE_IF_COPY(dna_sequence, 1);
+
+    PG_RETURN_POINTER(state);
+}
+
+Datum
+sketch_agg_combinefn(PG_FUNCTION_ARGS) {
+    MemoryContext aggcontext;
+    dna_sketch_builder *state1;
+    dna_sketch_builder *state2;
+
+    if (!AggCheckCallContext(fcinfo, &aggcontext))
+        elog(ERROR, "sketch_agg_combinefn called in non-aggregate context");
+
+    state1 = PG_ARGISNULL(0) ? NULL : (dna_sketch_builder *) PG_GETARG_POINTER(0);
+    state2 = PG_ARGISNULL(1) ? NULL : (dna_sketch_builder *) PG_GETARG_POINTER(1);
+
+    if (state2 == NULL) {
+        if (state1 == NULL)
+            PG_RETURN_NULL();
+        PG_RETURN_POINTER(state1);
+    }
+    if (state1 == NULL)
+        state1 = dna_sketch_builder_create(aggcontext, state2->k, state2->size, state2->max_hash);
+    else if (state1->k != state2->k || state1->size != state2->size || state1->max_hash != state2->max_hash)
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("k, size and scaled must be the same for all rows of sketch_agg")));
+
+    for (int i = 0; i < state2->n; i++)
+        dna_sketch_builder_add(state1, state2->hashes[i]);
+    PG_RETURN_POINTER(state1);
+}
+
+/* Serialized state: the sketch built so far, compacted, as dna_sketch_send writes it */
+Datum
+sketch_agg_serialfn(PG_FUNCTION_ARGS) {
+    dna_sketch_builder *state = (dna_sketch_builder *) PG_GETARG_POINTER(0);
+    StringInfoData buf;
+
+    if (!AggCheckCallContext(fcinfo, NULL))
+        elog(ERROR, "sketch_agg_serialfn called in non-aggregate context");
+
+    pq_begintypsend(&buf);
+    dna_sketch_write(&buf, dna_sketch_builder_finish(state));
+    PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
+}
+
+Datum
+sketch_agg_deserialfn(PG_FUNCTION_ARGS) {
+    bytea *sstate = PG_GETARG_BYTEA_PP(0);
+    dna_sketch_builder *state;
+    dna_sketch *sketch;
+    StringInfoData buf;
+
+    if (!AggCheckCallContext(fcinfo, NULL))
+        elog(ERROR, "sketch_agg_deserialfn called in non-aggregate context");
+
+    initStringInfo(&buf);
+    appendBinaryStringInfo(&buf, VARDATA_ANY(sstate), VARSIZE_ANY_EXHDR(sstate));
+    sketch = dna_sketch_read(&buf);
+    pq_getmsgend(&buf);
+    pfree(buf.data);
+
+    state = dna_sketch_builder_create(CurrentMemoryContext, sketch->k, sketch->size, sketch->max_hash);
+    for (int i = 0; i < sketch->n; i++)
+        dna_sketch_builder_add(state, sketch->hashes[i]);
+    pfree(sketch);
+
+    PG_RETURN_POINTER(state);
+}
+
+Datum
+sketch_agg_finalfn(PG_FUNCTION_ARGS) {
+    dna_sketch_builder *state = (dna_sketch_builder *) PG_GETARG_POINTER(0);
+    PG_RETURN_DNA_SKETCH_P(dna_sketch_builder_finish(state));
+}
+
+// ********** hll **********
+Datum
+hll_in(PG_FUNCTION_ARGS) {
+    PG_RETURN_HLL_P(hex_external_in(PG_GETARG_CSTRING(0), "hll", hll_read));
+}
+
+Datum
+hll_out(PG_FUNCTION_ARGS) {
+    hll *h = PG_GETARG_HLL_P(0);
+    char *result = hex_external_out(h, hll_write);
+
+    PG_FREE_IF_COPY(h, 0);
+    PG_RETURN_CSTRING(result);
+}
+
+Datum
+hll_recv(PG_FUNCTION_ARGS) {
+    StringInfo buf = (StringInfo) PG_GETARG_POINTER(0);
+    PG_RETURN_HLL_P(hll_read(buf));
+}
+
+Datum
+hll_send(PG_FUNCTION_ARGS) {
+    hll *h = PG_GETARG_HLL_P(0);
+    StringInfoData buf;
+
+    pq_begintypsend(&buf);
+    hll_write(&buf, h);
+    PG_FREE_IF_COPY(h, 0);
+    PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
+}
+
+/* Check the parameters of kmer_hll() and hll_agg() */
+static void
+hll_check_params(int k, int precision)
+{
+    if (k <= 0 || k > MAX_KMER_LEN)
+        ereport(ERROR, (errmsg("Invalid k value: must be between 1 and %d", MAX_KMER_LEN)));
+    if (precision < HLL_MIN_PRECISION || precision > HLL_MAX_PRECISION)
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("Invalid precision: must be between %d and %d",
+                               HLL_MIN_PRECISION, HLL_MAX_PRECISION)));
+}
+
+/* HyperLogLog of the k-mers of a sequence */
+Datum
+kmer_hll(PG_FUNCTION_ARGS) {
+    dna *dna_sequence = PG_GETARG_DNA_P(0);
+    int k = PG_GETARG_INT32(1);
+    int precision = PG_GETARG_INT32(2);
+    hll *result;
+
+    hll_check_params(k, precision);
+    result = hll_create(CurrentMemoryContext, k, precision);
+    hll_add_dna(result, dna_sequence);
+    PG_FREE_IF_COPY(dna_sequence, 0);
+    PG_RETURN_HLL_P(result);
+}
+
+Datum
+hll_cardinality(PG_FUNCTION_ARGS) {
+    hll *h = PG_GETARG_HLL_P(0);
+    int64 result = (int64) rint(hll_estimate(h));
+
+    PG_FREE_IF_COPY(h, 0);
+    PG_RETURN_INT64(result);
+}
+
+Datum
+hll_union(PG_FUNCTION_ARGS) {
+    hll *a = PG_GETARG_HLL_P(0);
+    hll *b = PG_GETARG_HLL_P(1);
+    hll *result = (hll *) palloc(VARSIZE(a));
+
+    memcpy(result, a, VARSIZE(a));
+    hll_merge(result, b);
+    PG_FREE_IF_COPY(a, 0);
+    PG_FREE_IF_COPY(b, 1);
+    PG_RETURN_HLL_P(result);
+}
+
+// hll_agg, approx_distinct_kmers and hll_union_agg aggregates
+Datum
+hll_agg_transfn(PG_FUNCTION_ARGS) {
+    MemoryContext aggcontext;
+    hll *state;
+    dna *dna_sequence;
+    int k;
+    /* hll_agg(dna, integer, integer) sets the precision */
+    int precision = PG_NARGS() > 3 && !PG_ARGISNULL(3) ? PG_GETARG_INT32(3) : HLL_DEFAULT_PRECISION;
+
+    if (!AggCheckCallContext(fcinfo, &aggcontext))
+        elog(ERROR, "hll_agg_transfn called in non-aggregate context");
+
+    state = PG_ARGISNULL(0) ? NULL : (hll *) PG_GETARG_POINTER(0);
+    if (PG_ARGISNULL(1) || PG_ARGISNULL(2)) {
+        if (state == NULL)
+            PG_RETURN_NULL();
+        PG_RETURN_POINTER(state);
+    }
+
+    k = PG_GETARG_INT32(2);
+    if (state == NULL) {
+        hll_check_params(k, precision);
+        state = hll_create(aggcontext, k, precision);
+    } else if (state->k != k || state->precision != precision)
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("k and precision must be the same for all rows of the aggregate")));
+
+    dna_sequence = PG_GETARG_DNA_P(1);
+    hll_add_dna(state, dna_sequence);
+    PG_FREE_IF_COPY(dna_sequence, 1);
+
+    PG_RETURN_POINTER(state);
+}
+
+Datum
+hll_union_agg_transfn(PG_FUNCTION_ARGS) {
+    MemoryContext aggcontext;
+    hll *state;
+    hll *h;
+
+    if (!AggCheckCallContext(fcinfo, &aggcontext))
+        elog(ERROR, "hll_union_agg_transfn called in non-aggregate context");
+
+    state = PG_ARGISNULL(0) ? NULL : (hll *) PG_GETARG_POINTER(0);
+    if (PG_ARGISNULL(1)) {
+        if (state == NULL)
+            PG_RETURN_NULL();
+        PG_RETURN_POINTER(state);
+    }
+
+    h = PG_GETARG_HLL_P(1);
+    if (state == NULL)
+        state = hll_create(aggcontext, h->k, h->precision);
+    hll_merge(state, h);
+    PG_FREE_IF_COPY(h, 1);
+
+    PG_RETURN_POINTER(state);
+}
+
+Datum
+hll_agg_combinefn(PG_FUNCTION_ARGS) {
+    MemoryContext aggcontext;
+    hll *state1;
+    hll *state2;
+
+    if (!AggCheckCallContext(fcinfo, &aggcontext))
+        elog(ERROR, "hll_agg_combinefn called in non-aggregate context");
+
+    state1 = PG_ARGISNULL(0) ? NULL : (hll *) PG_GETARG_POINTER(0);
+    state2 = PG_ARGISNULL(1) ? NULL : (hll *) PG_GETARG_POINTER(1);
+
+    if (state2 == NULL) {
+        if (state1 == NULL)
+            PG_RETURN_NULL();
+        PG_RETURN_POINTER(state1);
+    }
+    if (state1 == NULL)
+        state1 = hll_create(aggcontext, state2->k, state2->precision);
+
+    hll_merge(state1, state2);
+    PG_RETURN_POINTER(state1);
+}
+
+/* Serialized state: the hll itself, as hll_send writes it */
+Datum
+hll_agg_serialfn(PG_FUNCTION_ARGS) {
+    hll *state = (hll *) PG_GETARG_POINTER(0);
+    StringInfoData buf;
+
+    if (!AggCheckCallContext(fcinfo, NULL))
+        elog(ERROR, "hll_agg_serialfn called in non-aggregate context");
+
+    pq_begintypsend(&buf);
+    hll_write(&buf, state);
+    PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
+}
+
+Datum
+hll_agg_deserialfn(PG_FUNCTION_ARGS) {
+    bytea *sstate = PG_GETARG_BYTEA_PP(0);
+    hll *state;
+    StringInfoData buf;
+
+    if (!AggCheckCallContext(fcinfo, NULL))
+        elog(ERROR, "hll_agg_deserialfn called in non-aggregate context");
+
+    initStringInfo(&buf);
+    appendBinaryStringInfo(&buf, VARDATA_ANY(sstate), VARSIZE_ANY_EXHDR(sstate));
+    state = hll_read(&buf);
+    pq_getmsgend(&buf);
+    pfree(buf.data);
+
+    PG_RETURN_POINTER(state);
+}
+
+Datum
+hll_agg_finalfn(PG_FUNCTION_ARGS) {
+    hll *state = (hll *) PG_GETARG_POINTER(0);
+    hll *result = (hll *) palloc(VARSIZE(state));
+
+    memcpy(result, state, VARSIZE(state));
+    PG_RETURN_HLL_P(result);
+}
+
+Datum
+approx_distinct_kmers_finalfn(PG_FUNCTION_ARGS) {
+    hll *state = (hll *) PG_GETARG_POINTER(0);
+    PG_RETURN_INT64((int64) rint(hll_estimate(state)));
+}
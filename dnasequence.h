@@ -4,29 +4,79 @@
 #include <math.h>
 #include <float.h>
 #include <stdlib.h>
+#include <sys/stat.h>
 
 #include "postgres.h"
 #include "fmgr.h"
+#include "lib/stringinfo.h"
 #include "libpq/pqformat.h"
+#include "utils/array.h"
 #include "utils/fmgrprotos.h"
+#include "utils/lsyscache.h"
+#include "utils/selfuncs.h"
+#include "utils/guc.h"
 
+#include "access/brin_tuple.h"
+#include "access/gin.h"
+#include "access/htup_details.h"
+#include "access/parallel.h"
+#include "access/reloptions.h"
 #include "access/spgist.h"
+#include "access/stratnum.h"
+#include "catalog/pg_am.h"
+#include "catalog/pg_authid.h"
+#include "catalog/pg_foreign_table.h"
+#include "catalog/pg_type.h"
+#include "catalog/pg_statistic.h"
+#include "commands/defrem.h"
+#include "commands/explain.h"
+#include "commands/vacuum.h"
 #include "common/int.h"
+#include "port/pg_bitutils.h"
+#include "executor/nodeHash.h"
+#include "foreign/fdwapi.h"
+#include "foreign/foreign.h"
+#include "miscadmin.h"
+#include "nodes/makefuncs.h"
+#include "nodes/nodeFuncs.h"
+#include "nodes/supportnodes.h"
+#include "optimizer/cost.h"
+#include "optimizer/optimizer.h"
+#include "optimizer/pathnode.h"
+#include "optimizer/paths.h"
+#include "optimizer/planmain.h"
+#include "optimizer/restrictinfo.h"
+#include "port/atomics.h"
+#include "storage/buffile.h"
+#include "storage/fd.h"
+#include "utils/acl.h"
+#include "utils/builtins.h"
 #include "utils/datum.h"
 #include "utils/pg_locale.h"
+#include "utils/rel.h"
+#include "utils/sortsupport.h"
 #include "utils/varlena.h"
 
 #include "c.h"
 
 #include "data_types/dna.h"
 #include "data_types/kmer.h"
+#include "data_types/kmer_count.h"
+#include "data_types/kmer_sample.h"
 #include "data_types/qkmer.h"
+#include "data_types/sketch.h"
+#include "data_types/hll.h"
 
 // dna macros
 #define DatumGetDnaP(X) ((dna *) PG_DETOAST_DATUM(X))
 #define DnaPGetDatum(X) PointerGetDatum(X)
 #define PG_GETARG_DNA_P(n) DatumGetDnaP(PG_GETARG_DATUM(n))
 #define PG_RETURN_DNA_P(x) return DnaPGetDatum(x)
+// Partial fetches, reading only the needed part of a toasted value
+#define PG_GETARG_DNA_HEADER(n) \
+    ((dna *) PG_DETOAST_DATUM_SLICE(PG_GETARG_DATUM(n), 0, DNA_HDRSZ - VARHDRSZ))
+#define PG_GETARG_DNA_BYTES(n, first, count) \
+    ((uint8 *) VARDATA(PG_DETOAST_DATUM_SLICE(PG_GETARG_DATUM(n), DNA_HDRSZ - VARHDRSZ + (first), (count))))
 
 // kmer macros
 #define DatumGetKmerP(X) ((kmer *) DatumGetPointer(X))
@@ -40,6 +90,18 @@
 #define PG_GETARG_QKMER_P(n) DatumGetQkmerP(PG_GETARG_DATUM(n))
 #define PG_RETURN_QKMER_P(x) return QkmerPGetDatum(x)
 
+// dna_sketch macros
+#define DatumGetDnaSketchP(X) ((dna_sketch *) PG_DETOAST_DATUM(X))
+#define DnaSketchPGetDatum(X) PointerGetDatum(X)
+#define PG_GETARG_DNA_SKETCH_P(n) DatumGetDnaSketchP(PG_GETARG_DATUM(n))
+#define PG_RETURN_DNA_SKETCH_P(x) return DnaSketchPGetDatum(x)
+
+// hll macros
+#define DatumGetHllP(X) ((hll *) PG_DETOAST_DATUM(X))
+#define HllPGetDatum(X) PointerGetDatum(X)
+#define PG_GETARG_HLL_P(n) DatumGetHllP(PG_GETARG_DATUM(n))
+#define PG_RETURN_HLL_P(x) return HllPGetDatum(x)
+
 // SP-GiST
 
 /* Struct for sorting values in picksplit */
@@ -54,5 +116,37 @@ typedef uint16 StrategyNumber;
 #define EqualStrategyNumber         1
 #define StartsWithStrategyNumber	2
 #define ContainsStrategyNumber		3
+#define HammingStrategyNumber		4
+#define DistanceStrategyNumber		5
+
+// BRIN
+
+/* Strategies 1-5 are the btree ones */
+#define BrinStartsWithStrategyNumber    6
+
+// GIN
+
+#define GinContainsKmerStrategyNumber   1
+#define GinContainsQkmerStrategyNumber  2
+
+/* Default length of the k-mers indexed by dna_gin_ops */
+#define DNA_GIN_DEFAULT_K   12
+
+/* Opclass options of dna_gin_ops */
+typedef struct
+{
+    int32   vl_len_;    /* varlena header (do not touch directly!) */
+    int     k;          /* length of the indexed k-mers */
+} DnaGinOptions;
+
+/* Largest Hamming distance accepted by the % operator */
+extern int hamming_threshold;
+
+// Statistics
+
+/* pg_statistic slot kinds collected by kmer_typanalyze (private range) */
+#define STATISTIC_KIND_KMER_LENGTH  10001   /* fraction of values per length */
+#define STATISTIC_KIND_KMER_BASES   10002   /* base frequencies per position */
+#define STATISTIC_KIND_DNA_LENGTH   10003   /* average number of bases */
 
 #endif // DNASEQUENCE_H
\ No newline at end of file
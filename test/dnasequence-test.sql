@@ -25,13 +25,29 @@ INSERT INTO seqs (dna) VALUES (('ACGT' || repeat('GT', 3500))::text::dna);
 
 -- Invalid characters
 INSERT INTO seqs VALUES (6,'ATGXAY'); -- Should fail
-INSERT INTO seqs (dna) VALUES (''); -- Should fail 
+INSERT INTO seqs (dna) VALUES (''); -- Should fail
+INSERT INTO seqs (dna) VALUES ('ACG T'); -- Should fail, no whitespace in values
+
+-- IUPAC codes other than ACGT are kept as runs, and the text form reads back
+SELECT 'acgNNNNtrA'::dna; -- ACGNNNNTRA
+SELECT 'ACGNNNNTRA'::dna::text::dna; -- ACGNNNNTRA
+CREATE TABLE seqs_text AS SELECT dna::text AS dna FROM seqs;
+INSERT INTO seqs_text VALUES ('NNNNACGTNNNN');
+SELECT count(*) FROM seqs_text WHERE dna::dna::text <> dna; -- 0
+DROP TABLE seqs_text;
 
 -- Test length() function
 SELECT dna, length(dna) FROM seqs;
 SELECT dna, length(dna) FROM seqs WHERE length(dna) = 1;
 SELECT length(dna) FROM seqs WHERE length(dna) > 5000;
 
+-- Windows of a sequence; only the toast chunks under the window are read
+SELECT substring('ACGTACGTAA'::dna, 3, 4); -- GTAC
+SELECT substring('ACGTACGTAA'::dna, 0, 3); -- AC
+SELECT substring('ACGTACGTAA'::dna, 20, 3) IS NULL; -- true, no bases in the window
+SELECT substring('ACGTACGTAA'::dna, 3, 0) IS NULL; -- true
+SELECT substring(dna, 7000, 10) FROM seqs WHERE length(dna) > 5000;
+
 
 
 -- Generate kmers from DNA
@@ -93,6 +109,26 @@ SELECT * FROM kmers WHERE kmer ^@ 'gAT';
 SELECT * FROM kmers WHERE starts_with('ACGTX', kmer); -- Should fail 
 SELECT * FROM kmers WHERE kmer ^@ '123'; -- Should fail 
 
+-- Test Hamming distance
+SELECT kmer, kmer <-> 'ACGTA' AS dist FROM kmers ORDER BY dist;
+SELECT 'ACGTA'::kmer <-> 'ACCTT'; -- 2
+SELECT 'ACGTA'::kmer <-> 'ACG'; -- 2, missing bases count as mismatches
+SELECT * FROM kmers WHERE kmer % 'ACGTT'; -- within dnasequence.hamming_threshold (2)
+
+-- Strands: reverse complement and canonical k-mers
+SELECT reverse_complement('ACGTTNGA'::dna); -- TCNAACGT
+SELECT reverse_complement('AACGT'::kmer), canonical('TTACG'::kmer); -- ACGTT, CGTAA
+SELECT k FROM generate_kmers('ACGTT', 3, canonical => true) AS k; -- ACG, ACG, AAC
+SELECT * FROM kmer_count('AAAATTTT', 4, true); -- AAAA 2, AAAT 2, AATT 1
+SELECT kmer_spectrum(genome, 21, true) FROM (VALUES ('ACGTTGCAACGT'::dna)) AS g(genome);
+
+-- Sampling: minimizers and closed syncmers
+SELECT * FROM generate_minimizers('ACGTTGCATGTCGCATGATGCATGAGAGCT', 5, 4);
+SELECT * FROM generate_syncmers('ACGTTGCATGTCGCATGATGCATGAGAGCT', 5, 2, canonical => true);
+SELECT count(*) AS minimizers, (SELECT count(*) FROM generate_kmers(genome, 21)) AS kmers
+FROM (VALUES ('ACGTTGCATGTCGCATGATGCATGAGAGCTACGTTGCATGTCGCATGATGCATGAGAGCT'::dna)) AS g(genome),
+     generate_minimizers(genome, 21, 10);
+
 
 -- **********************************
 -- * qkmer
@@ -127,6 +163,7 @@ INSERT INTO qkmers (qkmer) VALUES (''); -- Should fail
 
 -- Test length function
 SELECT qkmer, length(qkmer) FROM qkmers;
+SELECT qkmer, pg_column_size(qkmer) FROM qkmers; -- 20 bytes: 4-bit base sets
 SELECT kmer, length(kmer) FROM kmers WHERE length(kmer) BETWEEN 1 AND 32;
 
 
@@ -151,6 +188,23 @@ FROM generate_kmers('ACGTACGTGATTCACGTACGT', 5) AS k(kmer)
 GROUP BY k.kmer
 ORDER BY count(*) DESC;
 
+-- Same counts without GROUP BY
+SELECT kmer, count
+FROM kmer_count('ACGTACGTGATTCACGTACGT', 5)
+ORDER BY count DESC;
+
+-- More distinct k-mers than fit in work_mem spill to temporary files
+SET work_mem = '64kB';
+SELECT setseed(0.5);
+CREATE TEMP TABLE random_genome AS
+SELECT string_agg(substr('ACGT', (random() * 3)::int + 1, 1), '')::dna AS genome
+FROM generate_series(1, 50000);
+SELECT (SELECT count(*) FROM kmer_count(genome, 20)) =
+       (SELECT count(DISTINCT k) FROM generate_kmers(genome, 20) AS k) AS same_kmers,
+       (SELECT sum(count) FROM kmer_count(genome, 20)) AS windows -- 49981
+FROM random_genome;
+RESET work_mem;
+
 -- Test with invalid characters -- should fail
 SELECT k.kmer, count(*)
 FROM generate_kmers('AOISJCGTGATTSADFDCACGTACAFGT', 5) AS k(kmer)
@@ -187,6 +241,88 @@ FROM kmers;
 -- -------------+----------------+--------------
 --           17 |             13 |            9
 
+-- Distinct count in one pass with a HyperLogLog, no GROUP BY
+SELECT approx_distinct_kmers('ACGTACGTGATTCACGTACGT', 5); -- 13
+
+-- Per-sample hlls stored and unioned later
+CREATE TABLE sample_hlls AS
+SELECT id, hll_agg(dna, 5) AS kmers FROM seqs WHERE length(dna) >= 5 GROUP BY id;
+SELECT id, cardinality(kmers) FROM sample_hlls ORDER BY id;
+SELECT cardinality(hll_union_agg(kmers)) FROM sample_hlls;
+SELECT cardinality(hll_union(kmer_hll('ACGTACGTGA', 5), kmer_hll('TTCACGTACGT', 5, log2m => 14)));
+SELECT cardinality(kmers::text::hll) = cardinality(kmers) FROM sample_hlls;
+SELECT hll_union(kmer_hll('ACGTACGTGA', 5), kmer_hll('ACGTACGTGA', 6)); -- Should fail
+
+-- **********************************
+-- * SKETCHES
+-- **********************************
+CREATE TABLE sketch_genomes(id SERIAL PRIMARY KEY, genome dna, sketch dna_sketch);
+INSERT INTO sketch_genomes (genome) VALUES
+    ('ACGTTGCATGTCGCATGATGCATGAGAGCTACGTTGCATGTCGCATGATGCATGAGAGCT'),
+    ('ACGTTGCATGTCGCATGATGCATGAGAGCTTTTTGGGGCCCCAAAATTTTGGGGCCCCAA'),
+    (reverse_complement('ACGTTGCATGTCGCATGATGCATGAGAGCTACGTTGCATGTCGCATGATGCATGAGAGCT'));
+UPDATE sketch_genomes SET sketch = sketch(genome, 11, 100);
+SELECT id, length(sketch) FROM sketch_genomes;
+
+-- All-vs-all comparison; the reverse strand gives the same sketch (distance 0)
+SELECT a.id, b.id, jaccard(a.sketch, b.sketch), containment(a.sketch, b.sketch),
+       a.sketch <-> b.sketch AS mash_distance
+FROM sketch_genomes a, sketch_genomes b
+WHERE a.id < b.id
+ORDER BY a.id, b.id;
+
+-- FracMinHash sketches keep about 1/scaled of the k-mers
+SELECT length(sketch(genome, 5, size => 0, scaled => 4)) FROM sketch_genomes;
+
+-- One sketch over many rows
+SELECT jaccard(sketch_agg(genome, 11, 100, 1), (SELECT sketch FROM sketch_genomes WHERE id = 1))
+FROM sketch_genomes;
+
+-- Text and binary round trips
+SELECT jaccard(sketch::text::dna_sketch, sketch) FROM sketch_genomes; -- 1
+SELECT sketch(genome, 11) <-> sketch(genome, 12) FROM sketch_genomes; -- Should fail
+
+-- **********************************
+-- * LOAD FASTA/FASTQ FILES (superuser, paths relative to the data directory)
+-- **********************************
+-- Records become (id, description, sequence) rows; N and other IUPAC codes are kept
+SELECT id, description, length(sequence) FROM read_fasta('/tmp/genome.fa');
+CREATE TABLE assembly AS SELECT * FROM read_fasta('/tmp/genome.fa');
+SELECT id, length(sequence), quality FROM read_fastq('/tmp/reads.fq') LIMIT 10;
+
+-- The same files as foreign tables; large files are scanned in parallel chunks
+CREATE SERVER seqfiles FOREIGN DATA WRAPPER dnasequence_fdw;
+CREATE FOREIGN TABLE reads (id text, sequence dna, quality text)
+    SERVER seqfiles OPTIONS (filename '/tmp/reads.fq');
+SELECT id, length(sequence) FROM reads LIMIT 10;
+-- With k set, every record is scanned as (id, kmer, position) rows
+CREATE FOREIGN TABLE read_kmers (id text, kmer kmer, position integer)
+    SERVER seqfiles OPTIONS (filename '/tmp/reads.fq', k '21');
+EXPLAIN SELECT kmer, count(*) FROM read_kmers GROUP BY kmer;
+SELECT kmer, count(*) FROM read_kmers GROUP BY kmer ORDER BY count(*) DESC LIMIT 10;
+
+-- Multi-line FASTQ records, the second quality starting with '@': the serial
+-- foreign scan returns every record, as read_fastq does
+COPY (VALUES ('@m1 first'), ('ACGTACGT'), ('ACG'), ('+'), ('IIIIIIII'), ('III'),
+             ('@m2'), ('TTGCA'), ('+'), ('@@II'), ('#'),
+             ('@m3'), ('GG'), ('CC'), ('+'), ('II'), ('II'))
+    TO '/tmp/multiline.fq';
+SELECT id, length(sequence), quality FROM read_fastq('/tmp/multiline.fq');
+CREATE FOREIGN TABLE multiline_reads (id text, description text, sequence dna, quality text)
+    SERVER seqfiles OPTIONS (filename '/tmp/multiline.fq');
+SELECT id, description, sequence, quality FROM multiline_reads; -- m1, m2, m3
+SELECT (SELECT count(*) FROM multiline_reads) = (SELECT count(*) FROM read_fastq('/tmp/multiline.fq')); -- t
+-- Even when parallel scans are cheap, the multi-line file is only scanned serially
+SET min_parallel_table_scan_size = 0;
+SET parallel_setup_cost = 0;
+SET parallel_tuple_cost = 0;
+EXPLAIN (COSTS OFF) SELECT count(*) FROM reads; -- Parallel Foreign Scan
+EXPLAIN (COSTS OFF) SELECT count(*) FROM multiline_reads; -- Foreign Scan, no Gather
+SELECT count(*) FROM multiline_reads; -- 3
+RESET min_parallel_table_scan_size;
+RESET parallel_setup_cost;
+RESET parallel_tuple_cost;
+
 -- **********************************
 -- * IMPORT CSV DATA
 -- **********************************
@@ -224,6 +360,26 @@ SELECT sum(count) AS total_count,
        count(*) FILTER (WHERE count = 1) AS unique_count
 FROM kmers_count;
 
+-- Row estimate of generate_kmers from the average genome length (length - k + 1)
+ANALYZE genomes;
+EXPLAIN SELECT generate_kmers(genome, 32) FROM genomes;
+EXPLAIN SELECT * FROM generate_kmers('ACGTACGTGATTCACGTACGT', 5); -- rows=17
+
+-- Planner statistics: MCVs, histogram, length and per-position base frequencies
+ANALYZE sample_32mers;
+EXPLAIN SELECT * FROM sample_32mers WHERE kmer ^@ 'ACG'; -- rows close to the actual count
+EXPLAIN SELECT * FROM sample_32mers WHERE 'ANGTANNNNNNNNNNNNNNNNNNNNNNNNNNN' @> kmer;
+
+-- k-mer spectrum (number of distinct 32-mers seen 1, 2, ... times), parallel-safe
+SELECT kmer_spectrum(genome, 32) FROM genomes;
+
+-- Binary COPY round trip of the packed formats (no text parsing)
+\copy genomes TO '/tmp/genomes.bin' WITH (FORMAT BINARY)
+CREATE TABLE genomes_copy (LIKE genomes);
+\copy genomes_copy FROM '/tmp/genomes.bin' WITH (FORMAT BINARY)
+SELECT count(*) FROM genomes g JOIN genomes_copy c ON g.genome::text = c.genome::text;
+SELECT kmer_send('ACGTA'), qkmer_send('ANGTR'); -- \x051b00 and \x051f4850
+
 -- **********************************
 -- * SP-GIST INDEX
 -- **********************************
@@ -241,6 +397,24 @@ EXPLAIN ANALYZE SELECT * FROM sample_32mers WHERE kmer ^@ 'ACG';
 -- *** Pattern matching using qkmer ***
 EXPLAIN ANALYZE SELECT * FROM sample_32mers WHERE 'ANGTA' @> kmer;
 
+-- *** Prefix search through the function form ***
+EXPLAIN ANALYZE SELECT * FROM sample_32mers WHERE starts_with('ACG', kmer);
+
+-- *** Prefix search on a btree index (rewritten to a range) ***
+CREATE INDEX kmer_btree_idx ON sample_32mers USING btree(kmer);
+EXPLAIN ANALYZE SELECT * FROM sample_32mers WHERE kmer ^@ 'ACG';
+EXPLAIN ANALYZE SELECT * FROM sample_32mers WHERE starts_with('ACG', kmer);
+DROP INDEX kmer_btree_idx;
+
+-- *** Nearest neighbours by Hamming distance ***
+EXPLAIN ANALYZE SELECT kmer, kmer <-> 'AAAGAGGCTAACAGGCTTTTGAAAAGTTATTC' AS dist
+FROM sample_32mers ORDER BY kmer <-> 'AAAGAGGCTAACAGGCTTTTGAAAAGTTATTC' LIMIT 10;
+
+-- *** Radius search (at most dnasequence.hamming_threshold mismatches) ***
+SET dnasequence.hamming_threshold = 3;
+EXPLAIN ANALYZE SELECT * FROM sample_32mers WHERE kmer % 'AAAGAGGCTAACAGGCTTTTGAAAAGTTATTC';
+RESET dnasequence.hamming_threshold;
+
 -- **********************************
 -- * SP-GIST COMPARISON
 -- **********************************
@@ -271,6 +445,43 @@ SET enable_seqscan = OFF;
 EXPLAIN ANALYZE SELECT * FROM sample_32mers WHERE 'ATCGAGNNNNNNNNNNNNNNNNNNNNNNNNNN' @> kmer;
 SELECT * FROM sample_32mers WHERE 'ATCGAGNNNNNNNNNNNNNNNNNNNNNNNNNN' @> kmer;
 
+-- **********************************
+-- * BRIN INDEXES
+-- **********************************
+CREATE TABLE sorted_32mers AS SELECT kmer FROM sample_32mers ORDER BY kmer;
+CREATE INDEX sorted_32mers_minmax_idx ON sorted_32mers USING brin (kmer);
+SET enable_seqscan = OFF;
+EXPLAIN ANALYZE SELECT * FROM sorted_32mers WHERE kmer = 'AAAGAGGCTAACAGGCTTTTGAAAAGTTATTC';
+EXPLAIN ANALYZE SELECT * FROM sorted_32mers WHERE kmer ^@ 'ACG';
+EXPLAIN ANALYZE SELECT * FROM sorted_32mers WHERE kmer BETWEEN 'ACG' AND 'ACT';
+DROP INDEX sorted_32mers_minmax_idx;
+CREATE INDEX sample_32mers_bloom_idx ON sample_32mers USING brin (kmer kmer_bloom_ops);
+EXPLAIN ANALYZE SELECT * FROM sample_32mers WHERE kmer = 'AAAGAGGCTAACAGGCTTTTGAAAAGTTATTC';
+DROP INDEX sample_32mers_bloom_idx;
+SET enable_seqscan = ON;
+
+-- **********************************
+-- * GIN INDEX ON DNA
+-- **********************************
+SELECT 'ACGTACGTGATTCACGTACGT'::dna @> 'GATTCA'::kmer; -- true
+SELECT 'ACGTACGTGATTCACGTACGT'::dna @> 'GANTCA'::qkmer; -- true
+CREATE INDEX genome_gin_idx ON genomes USING gin (genome dna_gin_ops (k = 16));
+SET enable_seqscan = OFF;
+EXPLAIN ANALYZE SELECT count(*) FROM genomes WHERE genome @> 'AAAGAGGCTAACAGGCTTTTGAAAAGTTATTC'::kmer;
+EXPLAIN ANALYZE SELECT count(*) FROM genomes WHERE genome @> 'AAAGAGGCTAACAGGCNNNNGAAAAGTTATTC'::qkmer;
+SET enable_seqscan = ON;
+DROP INDEX genome_gin_idx;
+
+-- **********************************
+-- * HASH PARTITIONING
+-- **********************************
+CREATE TABLE kmers_part (kmer kmer) PARTITION BY HASH (kmer);
+CREATE TABLE kmers_part_0 PARTITION OF kmers_part FOR VALUES WITH (MODULUS 2, REMAINDER 0);
+CREATE TABLE kmers_part_1 PARTITION OF kmers_part FOR VALUES WITH (MODULUS 2, REMAINDER 1);
+INSERT INTO kmers_part SELECT kmer FROM kmers;
+SELECT tableoid::regclass, kmer FROM kmers_part ORDER BY kmer;
+EXPLAIN SELECT * FROM kmers_part WHERE kmer = 'ACGTA'; -- scans a single partition
+
 -- **********************************
 -- * SYNTHETIC DATA
 -- **********************************